@@ -4,10 +4,14 @@ attribute vec3 vertex_position;
 uniform mat4 transform_matrix;
 uniform mat4 view_matrix;
 
+// Quantized positions arrive normalized to [0, 1] within the bounding box
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
 varying vec3 ec_pos;
 
 void main() {
     gl_Position = view_matrix*transform_matrix*
-        vec4(vertex_position, 1.0);
+        vec4(position_offset + position_scale*vertex_position, 1.0);
     ec_pos = gl_Position.xyz;
 }
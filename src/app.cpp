@@ -3,21 +3,22 @@
 #include <QFileOpenEvent>
 
 #include "app.h"
+#include "loadprofile.h"
+#include "singleinstance.h"
 #include "window.h"
 
-App::App(int& argc, char* argv[]) : QApplication(argc, argv), window(new Window())
+App::App(int& argc, char* argv[]) : QApplication(argc, argv), window(new Window()), instance(new SingleInstance(this))
 {
-    if (argc > 1) {
-        const auto args = QCoreApplication::arguments();
-        QString filename = args.at(1);
-        if (filename.startsWith("~")) {
-            filename.replace(0, 1, QDir::homePath());
-        }
-        window->load_stl(filename);
-    } else {
+    if (!open_args(QCoreApplication::arguments().mid(1), QDir::currentPath())) {
         window->load_stl(":gl/sphere.stl");
     }
     window->show();
+
+    if (SingleInstance::enabled()) {
+        instance->listen();
+    }
+    connect(window, &Window::single_instance_changed, this, &App::on_single_instance);
+    connect(instance, &SingleInstance::received, this, &App::on_instance_args);
 }
 
 App::~App()
@@ -25,6 +26,44 @@ App::~App()
     delete window;
 }
 
+bool App::open_args(QStringList args, const QString& dir)
+{
+    const int trace = args.indexOf("--trace");
+    if (trace >= 0 && trace + 1 < args.size()) {
+        LoadProfile::set_trace_path(QDir(dir).absoluteFilePath(args.at(trace + 1)));
+        args.erase(args.begin() + trace, args.begin() + trace + 2);
+    }
+
+    if (args.isEmpty()) {
+        return false;
+    }
+    for (auto& filename : args) {
+        if (filename.startsWith("~")) {
+            filename.replace(0, 1, QDir::homePath());
+        }
+        filename = QDir(dir).absoluteFilePath(filename);
+    }
+    window->load_files(args);
+    return true;
+}
+
+void App::on_single_instance(bool enabled)
+{
+    if (enabled) {
+        instance->listen();
+    } else {
+        instance->close();
+    }
+}
+
+void App::on_instance_args(const QStringList& args, const QString& dir)
+{
+    open_args(args, dir);
+    window->setWindowState((window->windowState() & ~Qt::WindowMinimized) | Qt::WindowActive);
+    window->raise();
+    window->activateWindow();
+}
+
 bool App::event(QEvent* e)
 {
     if (e->type() == QEvent::FileOpen) {
@@ -3,6 +3,7 @@
 
 #include <QApplication>
 
+class SingleInstance;
 class Window;
 
 class App : public QApplication
@@ -15,8 +16,18 @@ public:
 protected:
     bool event(QEvent* e) override;
 
+private slots:
+    void on_single_instance(bool enabled);
+    void on_instance_args(const QStringList& args, const QString& dir);
+
 private:
+    /*  Handles command-line arguments (without the program name), with
+     *  relative paths taken from the given directory.  Returns false if
+     *  there weren't any files to open. */
+    bool open_args(QStringList args, const QString& dir);
+
     Window* const window;
+    SingleInstance* const instance;
 };
 
 #endif // APP_H
@@ -4,8 +4,8 @@ Backdrop::Backdrop()
 {
     initializeOpenGLFunctions();
 
-    shader.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/gl/quad.vert");
-    shader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/quad.frag");
+    shader.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/gl/quad.vert");
+    shader.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/quad.frag");
     shader.link();
 
     float vbuf[] = {-1, -1, 0.00, 0.10, 0.15, -1, 1, 0.03, 0.21, 0.26, 1, -1, 0.00, 0.12, 0.18, 1, 1, 0.06, 0.26, 0.30};
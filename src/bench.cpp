@@ -0,0 +1,273 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QTemporaryFile>
+#include <QtEndian>
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "loader.h"
+#include "meshcache.h"
+
+#ifdef Q_OS_LINUX
+#    include <fcntl.h>
+#endif
+
+/*
+ *  Headless benchmark for the loading pipeline.  Each file (real or
+ *  synthetic) is read, decoded, welded and prepared for upload without
+ *  opening a window, and the per-stage timings are printed as JSON.
+ */
+
+namespace
+{
+/*  Writes a torus with roughly tri_count triangles, either as a binary
+ *  or an ASCII stl.  Like most scanned meshes, it welds down to about
+ *  half as many vertices as it has triangles. */
+bool write_torus(QFile& file, qint64 tri_count, bool ascii)
+{
+    const int rings = std::max(3, int(std::sqrt(tri_count / 2.0)));
+    const int sides = std::max(3, int(tri_count / 2 / rings));
+    const quint32 count = 2 * rings * sides;
+
+    auto point = [&](int r, int s) {
+        const double u = 2 * M_PI * (r % rings) / rings;
+        const double v = 2 * M_PI * (s % sides) / sides;
+        return Vertex((1 + 0.3 * cos(v)) * cos(u), (1 + 0.3 * cos(v)) * sin(u), 0.3 * sin(v));
+    };
+
+    QByteArray buf;
+    if (ascii) {
+        buf.append("solid torus\n");
+    } else {
+        buf.fill(0, 80);
+        quint32 le_count = qToLittleEndian(count);
+        buf.append(reinterpret_cast<const char*>(&le_count), sizeof(le_count));
+    }
+
+    auto triangle = [&](const Vertex& a, const Vertex& b, const Vertex& c) {
+        if (ascii) {
+            buf.append("facet normal 0 0 0\nouter loop\n");
+            for (const Vertex* v : {&a, &b, &c}) {
+                buf.append(QByteArray("vertex ") + QByteArray::number(v->x, 'e', 6) + " " + QByteArray::number(v->y, 'e', 6) + " " +
+                           QByteArray::number(v->z, 'e', 6) + "\n");
+            }
+            buf.append("endloop\nendfacet\n");
+        } else {
+            float data[12] = {0, 0, 0, a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z};
+            for (auto& f : data) {
+                f = qToLittleEndian(f);
+            }
+            buf.append(reinterpret_cast<const char*>(data), sizeof(data));
+            buf.append(2, '\0');
+        }
+    };
+
+    for (int r = 0; r < rings; ++r) {
+        for (int s = 0; s < sides; ++s) {
+            triangle(point(r, s), point(r + 1, s), point(r + 1, s + 1));
+            triangle(point(r, s), point(r + 1, s + 1), point(r, s + 1));
+        }
+        if (file.write(buf) != buf.size()) {
+            return false;
+        }
+        buf.clear();
+    }
+    if (ascii) {
+        file.write("endsolid torus\n");
+    }
+
+    // Backdate the file, so that the loader doesn't wait for a writer
+    file.flush();
+    return file.setFileTime(QDateTime::currentDateTime().addSecs(-3600), QFileDevice::FileModificationTime);
+}
+
+QJsonObject stage_json(const LoadProfile::Stage& stage)
+{
+    const double seconds = stage.duration_ns / 1e9;
+    QJsonObject out;
+    out["name"] = stage.name;
+    out["wall_ms"] = stage.duration_ns / 1e6;
+    out["bytes"] = stage.bytes;
+    out["items"] = stage.items;
+    out["mb_per_s"] = seconds > 0 ? stage.bytes / 1e6 / seconds : 0.0;
+    out["items_per_s"] = seconds > 0 ? stage.items / seconds : 0.0;
+    out["peak_rss_mb"] = stage.peak_rss / 1048576.0;
+    return out;
+}
+
+QJsonObject run_benchmark(const QString& path, bool cold, QuantizeMode quantize)
+{
+    QJsonObject out;
+    out["file"] = path;
+
+    LoadProfile outer;
+    QJsonArray stages;
+
+    // Pull the file through the page cache first (optionally evicting it
+    // beforehand), so that I/O is measured separately from decoding.
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        out["error"] = "missing file";
+        return out;
+    }
+#ifdef Q_OS_LINUX
+    if (cold) {
+        posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+#else
+    Q_UNUSED(cold);
+#endif
+    outer.begin("read");
+    QByteArray chunk(1 << 22, Qt::Uninitialized);
+    qint64 bytes = 0;
+    for (qint64 n; (n = file.read(chunk.data(), chunk.size())) > 0;) {
+        bytes += n;
+    }
+    outer.end(bytes);
+    stages.append(stage_json(outer.stages().last()));
+    out["bytes"] = bytes;
+
+    // Then run the loader synchronously on this thread, keeping the last
+    // mesh it emits (which is the indexed one).
+    Loader loader(nullptr, path, false, quantize);
+    Mesh* mesh = nullptr;
+    qint64 paged_triangles = 0;
+    QString error;
+    QObject::connect(&loader, &Loader::got_mesh, [&](Mesh* m, bool) {
+        delete mesh;
+        mesh = m;
+    });
+    QObject::connect(&loader, &Loader::got_paged_mesh, [&](PagedMesh* m, bool) {
+        paged_triangles = m->triCount();
+        delete m;
+    });
+    QObject::connect(&loader, &Loader::error_bad_stl, [&]() { error = "bad stl"; });
+    QObject::connect(&loader, &Loader::error_empty_mesh, [&]() { error = "empty mesh"; });
+    QObject::connect(&loader, &Loader::error_missing_file, [&]() { error = "missing file"; });
+    QObject::connect(&loader, &Loader::error_page_file, [&]() { error = "page file"; });
+    loader.run();
+
+    for (const auto& stage : loader.load_profile().stages()) {
+        stages.append(stage_json(stage));
+    }
+
+    // Files too big for memory are paged from disk, so there's no single
+    // mesh to upload
+    if (paged_triangles) {
+        out["triangles"] = paged_triangles;
+        out["paged"] = true;
+        out["total_ms"] = (outer.total_ns() + loader.load_profile().total_ns()) / 1e6;
+        out["stages"] = stages;
+        return out;
+    }
+    if (!error.isEmpty() || !mesh) {
+        out["error"] = error;
+        out["stages"] = stages;
+        return out;
+    }
+
+    // Finally, copy the buffers the way glBufferData would, which is all
+    // the preparation GLMesh needs before uploading.
+    outer.begin("upload");
+    const size_t vertex_bytes = mesh->vertexBufferSize();
+    const size_t index_bytes = mesh->indexBufferSize();
+    std::vector<char> staging(vertex_bytes + index_bytes);
+    memcpy(staging.data(), mesh->vertexBuffer(), vertex_bytes);
+    memcpy(staging.data() + vertex_bytes, mesh->indexBuffer(), index_bytes);
+    outer.end(staging.size(), mesh->triCount());
+    stages.append(stage_json(outer.stages().last()));
+
+    qint64 peak_rss = 0;
+    for (const LoadProfile* profile : {&outer, &loader.load_profile()}) {
+        for (const auto& stage : profile->stages()) {
+            peak_rss = std::max(peak_rss, stage.peak_rss);
+        }
+    }
+    const qint64 total_ns = outer.total_ns() + loader.load_profile().total_ns();
+    out["triangles"] = mesh->triCount();
+    out["vertices"] = qint64(mesh->vertexCount());
+    out["total_ms"] = total_ns / 1e6;
+    out["peak_rss_mb"] = peak_rss / 1048576.0;
+    out["stages"] = stages;
+    outer.write_trace(path);
+
+    delete mesh;
+    return out;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("fstl-app");
+    QCoreApplication::setApplicationName("fstl-bench");
+    QCoreApplication::setApplicationVersion(FSTL_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks fstl's mesh loading pipeline without opening a window.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("files", "STL files to load.", "[files...]");
+    const QCommandLineOption synthetic("synthetic", "Benchmark a generated mesh with about <count> triangles (repeatable).", "count");
+    const QCommandLineOption ascii("ascii", "Generate synthetic meshes as ASCII rather than binary STL.");
+    const QCommandLineOption cold("cold", "Evict each file from the page cache before reading it (Linux only).");
+    const QCommandLineOption cache("cache", "Allow the on-disk mesh cache (disabled by default).");
+    const QCommandLineOption output("json", "Write the JSON report to <file> instead of stdout.", "file");
+    const QCommandLineOption trace("trace", "Append Chrome trace events for every stage to <file>.", "file");
+    const QCommandLineOption quantized("quantize", "Quantize vertex positions to 16 bits.");
+    parser.addOptions({synthetic, ascii, cold, cache, output, trace, quantized});
+    parser.process(app);
+    const QuantizeMode quantize = parser.isSet(quantized) ? quantize_always : quantize_never;
+
+    if (parser.isSet(trace)) {
+        LoadProfile::set_trace_path(parser.value(trace));
+    }
+    LoadProfile::set_stage_peaks(true);
+
+    QSettings().setValue(MeshCache::CACHE_SIZE_KEY, parser.isSet(cache) ? 2048 : 0);
+
+    QJsonArray runs;
+    for (const auto& path : parser.positionalArguments()) {
+        runs.append(run_benchmark(path, parser.isSet(cold), quantize));
+    }
+    for (const auto& count : parser.values(synthetic)) {
+        QTemporaryFile file(QDir::tempPath() + "/fstl-bench-XXXXXX.stl");
+        if (!file.open() || !write_torus(file, count.toLongLong(), parser.isSet(ascii))) {
+            qCritical("Could not write synthetic mesh to %s", qPrintable(file.fileName()));
+            return 1;
+        }
+        file.close();
+        QJsonObject run = run_benchmark(file.fileName(), parser.isSet(cold), quantize);
+        run["synthetic"] = parser.isSet(ascii) ? "ascii" : "binary";
+        runs.append(run);
+    }
+    if (runs.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    QJsonObject report;
+    report["version"] = FSTL_VERSION;
+    report["threads"] = int(std::thread::hardware_concurrency());
+    report["runs"] = runs;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(output)) {
+        QFile out(parser.value(output));
+        if (!out.open(QIODevice::WriteOnly) || out.write(json) != json.size()) {
+            qCritical("Could not write %s", qPrintable(parser.value(output)));
+            return 1;
+        }
+    } else {
+        fputs(json.constData(), stdout);
+    }
+    return 0;
+}
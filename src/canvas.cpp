@@ -1,15 +1,21 @@
 #include <QMouseEvent>
 
+#include <algorithm>
 #include <cmath>
 
 #include "axis.h"
 #include "backdrop.h"
 #include "canvas.h"
 #include "glmesh.h"
+#include "glpagedmesh.h"
 #include "mesh.h"
+#include "meshpatch.h"
+#include "pagedmesh.h"
+#include "uploader.h"
 
 const float Canvas::P_PERSPECTIVE = 0.25f;
 const float Canvas::P_ORTHOGRAPHIC = 0.0f;
+const float Canvas::MIN_RENDER_SCALE = 0.25f;
 
 const QString Canvas::AMBIENT_COLOR = "ambientColor";
 const QString Canvas::AMBIENT_FACTOR = "ambientFactor";
@@ -39,8 +45,28 @@ auto position(const QWheelEvent* const event)
 } // namespace
 
 Canvas::Canvas(const QSurfaceFormat& format, QWidget* parent) :
-    QOpenGLWidget(parent), mesh(nullptr), scale(1), zoom(1), anim(this, "perspective"), status(" "), meshInfo("")
+    QOpenGLWidget(parent),
+    uploader(nullptr),
+    upload_serial(0),
+    scene_size(1),
+    scene_pending(false),
+    scale(1),
+    zoom(1),
+    anim(this, "perspective"),
+    dragging(false),
+    frame_ms(0),
+    lod(0),
+    adaptiveResolution(true),
+    supersampleStill(false),
+    render_scale(1),
+    max_texture_size(0),
+    offscreen(nullptr),
+    status(" "),
+    meshInfo(""),
+    painted(false)
 {
+    startup.begin("window");
+    std::fill(std::begin(mesh_programs), std::end(mesh_programs), nullptr);
     setFormat(format);
     QFile styleFile(":/qt/style.qss");
     styleFile.open(QFile::ReadOnly);
@@ -79,13 +105,26 @@ Canvas::Canvas(const QSurfaceFormat& format, QWidget* parent) :
     }
 
     anim.setDuration(100);
+
+    // Once the view has been still for a moment, redraw at full detail
+    interaction.setSingleShot(true);
+    interaction.setInterval(SETTLE_MS);
+    QObject::connect(&interaction, &QTimer::timeout, this, [this]() { update(); });
+    QObject::connect(this, &QOpenGLWidget::frameSwapped, this, &Canvas::on_frame_swapped);
+    QObject::connect(&anim, &QPropertyAnimation::finished, this, [this]() { update(); });
 }
 
 Canvas::~Canvas()
 {
+    delete uploader;
     makeCurrent();
-    delete mesh;
-    delete mesh_vertshader;
+    for (const auto& part : parts) {
+        delete part.mesh;
+        qDeleteAll(part.lods);
+        delete part.paged;
+    }
+    delete offscreen;
+    qDeleteAll(std::begin(mesh_programs), std::end(mesh_programs));
     delete backdrop;
     delete axis;
     doneCurrent();
@@ -166,6 +205,18 @@ void Canvas::invert_zoom(bool d)
     update();
 }
 
+void Canvas::adaptive_resolution(bool d)
+{
+    adaptiveResolution = d;
+    update();
+}
+
+void Canvas::supersample(bool d)
+{
+    supersampleStill = d;
+    update();
+}
+
 void Canvas::setResetTransformOnLoad(bool d)
 {
     resetTransformOnLoad = d;
@@ -182,29 +233,367 @@ void Canvas::resetTransform()
     zoom = 1;
 }
 
-void Canvas::load_mesh(Mesh* m, bool is_reload)
+void Canvas::begin_scene(int count, bool is_reload)
+{
+    // The old parts stay on screen until the first new one arrives
+    scene_size = count;
+    scene_pending = !is_reload || count != parts.size();
+}
+
+Canvas::Part& Canvas::reset_part(int part)
+{
+    if (scene_pending) {
+        for (const auto& old : parts) {
+            delete old.mesh;
+            qDeleteAll(old.lods);
+            delete old.paged;
+        }
+        parts.fill(Part(), scene_size);
+        scene_pending = false;
+    }
+    if (part >= parts.size()) {
+        parts.resize(part + 1);
+    }
+    Part& p = parts[part];
+    qDeleteAll(p.lods);
+    delete p.paged;
+    p.lods.clear();
+    p.paged = nullptr;
+    p.loaded = true;
+    p.serial = ++upload_serial;
+    p.uploads = 0;
+    return p;
+}
+
+void Canvas::upload(Mesh* m, int part, bool lod)
+{
+    Part& p = parts[part];
+    if (uploader && (p.uploads || m->vertexBufferSize() + m->indexBufferSize() >= ASYNC_UPLOAD_BYTES)) {
+        uploads[++upload_serial] = {part, p.serial, lod, -1};
+        uploader->upload(m, upload_serial);
+        p.uploads++;
+        return;
+    }
+
+    GLMesh* mesh = new GLMesh(m);
+    if (lod) {
+        p.lods.push_back(mesh);
+    } else {
+        delete p.mesh;
+        p.mesh = mesh;
+    }
+    delete m;
+}
+
+void Canvas::on_uploaded(GLMesh* mesh, quint64 tag)
+{
+    // Uploads for a part that has since been given another mesh (or that
+    // belongs to an old scene) are dropped
+    makeCurrent();
+    const Upload u = uploads.take(tag);
+    if (u.part >= parts.size() || parts[u.part].serial != u.serial) {
+        delete mesh;
+        doneCurrent();
+        return;
+    }
+
+    Part& p = parts[u.part];
+    if (mesh) {
+        mesh->adopt();
+    }
+    if (u.page >= 0) {
+        p.paged->add_page(u.page, mesh);
+        doneCurrent();
+        update();
+        return;
+    } else if (u.lod) {
+        p.lods.push_back(mesh);
+    } else {
+        delete p.mesh;
+        p.mesh = mesh;
+    }
+    p.uploads--;
+    doneCurrent();
+    update();
+}
+
+void Canvas::update_scene(bool is_reload, bool first)
 {
-    delete mesh;
-    mesh = new GLMesh(m);
-    QVector3D lower(m->xmin(), m->ymin(), m->zmin());
-    QVector3D upper(m->xmax(), m->ymax(), m->zmax());
+    bool any = false;
+    for (const auto& other : parts) {
+        if (!other.loaded) {
+            continue;
+        }
+        for (int i = 0; i < 3; ++i) {
+            scene_lower[i] = any ? std::min(scene_lower[i], other.lower[i]) : other.lower[i];
+            scene_upper[i] = any ? std::max(scene_upper[i], other.upper[i]) : other.upper[i];
+        }
+        any = true;
+    }
+
     if (!is_reload) {
-        default_center = center = (lower + upper) / 2;
-        default_scale = scale = 2 / (upper - lower).length();
+        default_center = center = (scene_lower + scene_upper) / 2;
+        default_scale = scale = 2 / (scene_upper - scene_lower).length();
 
         // Reset other camera parameters
-        zoom = 1;
-        if (resetTransformOnLoad) {
-            resetTransform();
+        if (first) {
+            zoom = 1;
+            if (resetTransformOnLoad) {
+                resetTransform();
+            }
         }
     }
-    meshInfo = QStringLiteral("Triangles: %1\nX: [%2, %3]\nY: [%4, %5]\nZ: [%6, %7]").arg(m->triCount());
+}
+
+QString Canvas::part_info(const Part& p, const MeshStats* stats)
+{
+    QString info = QStringLiteral("Triangles: %1\nX: [%2, %3]\nY: [%4, %5]\nZ: [%6, %7]").arg(p.tri_count);
     for (int dIdx = 0; dIdx < 3; dIdx++)
-        meshInfo = meshInfo.arg(lower[dIdx]).arg(upper[dIdx]);
-    axis->setScale(lower, upper);
+        info = info.arg(p.lower[dIdx]).arg(p.upper[dIdx]);
+    if (stats) {
+        info += QStringLiteral("\nArea: %1\nVolume: %2\nCentroid: (%3, %4, %5)\nEdges: %6 to %7 (mean %8, sd %9)")
+                    .arg(stats->area)
+                    .arg(stats->volume)
+                    .arg(stats->centroid.x())
+                    .arg(stats->centroid.y())
+                    .arg(stats->centroid.z())
+                    .arg(stats->edge_min)
+                    .arg(stats->edge_max)
+                    .arg(stats->edge_mean)
+                    .arg(stats->edge_stddev);
+    }
+    if (p.quantization_error > 0) {
+        info += QStringLiteral("\nPositions: 16-bit, error up to %1").arg(p.quantization_error);
+    }
+    return info;
+}
+
+void Canvas::load_mesh(Mesh* m, bool is_reload, int part)
+{
+    // The camera is only fully reset for the first part of a scene, so
+    // that parts arriving later don't undo the user's rotation
+    const bool first = scene_pending;
+    Part& p = reset_part(part);
+
+    profile = LoadProfile();
+    profile.begin("bounds");
+    p.tri_count = m->triCount();
+    p.lower = QVector3D(m->xmin(), m->ymin(), m->zmin());
+    p.upper = QVector3D(m->xmax(), m->ymax(), m->zmax());
+    update_scene(is_reload, first);
+    profile.end(m->vertexBufferSize(), m->vertexCount());
+
+    p.quantization_error = m->quantizationError();
+    p.info = part_info(p, m->stats());
+
+    // Only meshes uploaded on this thread show up in the upload stage
+    profile.begin("upload");
+    const size_t bytes = m->vertexBufferSize() + m->indexBufferSize();
+    upload(m, part, false);
+    profile.end(p.uploads ? 0 : bytes, p.uploads ? 0 : p.tri_count);
+    profile.write_trace("canvas");
+
+    update_mesh_info();
+    loadInfo.clear();
+    axis->setScale(scene_lower, scene_upper);
     update();
+}
 
-    delete m;
+void Canvas::load_paged_mesh(PagedMesh* m, bool is_reload, int part)
+{
+    const bool first = scene_pending;
+    Part& p = reset_part(part);
+
+    profile = LoadProfile();
+    profile.begin("upload");
+    delete p.mesh;
+    p.mesh = nullptr;
+
+    // Pages are read and uploaded on the upload thread, if there is one
+    GLPagedMesh::Fetch fetch;
+    if (uploader) {
+        const quint64 serial = p.serial;
+        fetch = [this, part, serial](const QSharedPointer<PagedMesh>& source, size_t page) {
+            uploads[++upload_serial] = {part, serial, false, int(page)};
+            uploader->upload_page(source, page, upload_serial);
+        };
+    }
+    p.paged = new GLPagedMesh(m, fetch);
+    p.tri_count = m->triCount();
+    profile.end(0, p.tri_count);
+    profile.write_trace("canvas");
+
+    p.lower = m->stats().lower;
+    p.upper = m->stats().upper;
+    p.quantization_error = 0;
+    update_scene(is_reload, first);
+
+    p.info = part_info(p, &m->stats());
+    p.info += QStringLiteral("\nPaged from disk: %1 pages").arg(m->pages().size());
+    update_mesh_info();
+    loadInfo.clear();
+    axis->setScale(scene_lower, scene_upper);
+    update();
+}
+
+bool Canvas::patch_mesh(MeshPatch* patch, int part)
+{
+    if (scene_pending || part >= parts.size() || !parts[part].mesh || parts[part].uploads || parts[part].serial != patch->serial) {
+        delete patch;
+        return false;
+    }
+
+    Part& p = parts[part];
+    makeCurrent();
+    p.mesh->patch(patch->slots, patch->positions);
+    qDeleteAll(p.lods);
+    p.lods.clear();
+    doneCurrent();
+
+    p.lower = patch->stats.lower;
+    p.upper = patch->stats.upper;
+    update_scene(true, false);
+    p.info = part_info(p, &patch->stats);
+    delete patch;
+
+    update_mesh_info();
+    loadInfo.clear();
+    axis->setScale(scene_lower, scene_upper);
+    update();
+    return true;
+}
+
+quint64 Canvas::part_serial(int part) const
+{
+    return (scene_pending || part >= parts.size()) ? 0 : parts[part].serial;
+}
+
+void Canvas::update_mesh_info()
+{
+    if (parts.size() == 1) {
+        meshInfo = parts.front().info;
+        return;
+    }
+
+    int loaded = 0;
+    qint64 tri_count = 0;
+    for (const auto& part : parts) {
+        if (part.loaded) {
+            loaded++;
+            tri_count += part.tri_count;
+        }
+    }
+    meshInfo = QStringLiteral("Parts: %1 of %2\nTriangles: %3\nX: [%4, %5]\nY: [%6, %7]\nZ: [%8, %9]")
+                   .arg(loaded)
+                   .arg(parts.size())
+                   .arg(tri_count);
+    for (int dIdx = 0; dIdx < 3; dIdx++)
+        meshInfo = meshInfo.arg(scene_lower[dIdx]).arg(scene_upper[dIdx]);
+}
+
+void Canvas::add_lod(Mesh* m, int part)
+{
+    if (!scene_pending && part < parts.size()) {
+        upload(m, part, true);
+    } else {
+        delete m;
+    }
+}
+
+void Canvas::set_part_visible(int part, bool visible)
+{
+    if (!scene_pending && part < parts.size()) {
+        parts[part].visible = visible;
+        update();
+    }
+}
+
+int Canvas::lod_levels() const
+{
+    int levels = 0;
+    for (const auto& part : parts) {
+        levels = std::max(levels, part.lods.size());
+    }
+    return levels;
+}
+
+void Canvas::interact()
+{
+    // Coarser levels are always used while dragging, and otherwise only
+    // once the full mesh has been too slow to draw.
+    if (!interaction.isActive()) {
+        lod = std::min((dragging || frame_ms > FRAME_BUDGET_MS) ? 1 : 0, lod_levels());
+    }
+    interaction.start();
+}
+
+bool Canvas::moving() const
+{
+    return interaction.isActive() || anim.state() == QAbstractAnimation::Running;
+}
+
+void Canvas::on_frame_swapped()
+{
+    if (!painted) {
+        painted = true;
+        startup.end();
+        startup.write_trace("startup");
+    }
+
+    // Scale the render resolution so that frames land near the budget.
+    // Cost goes with pixel count, hence the square root, and the step is
+    // halved to smooth out noisy frame times.
+    frame_ms = frame_clock.elapsed();
+    if (moving() && adaptiveResolution) {
+        const float ratio = FRAME_BUDGET_MS / float(std::max<qint64>(frame_ms, 1));
+        render_scale = qBound(MIN_RENDER_SCALE, render_scale * (0.5f + 0.5f * std::sqrt(ratio)), 1.0f);
+    }
+
+    // While the view is moving, also step through the levels of detail
+    if (interaction.isActive()) {
+        const int levels = lod_levels();
+        if (frame_ms > FRAME_BUDGET_MS && lod < levels) {
+            lod++;
+        } else if (frame_ms < FRAME_BUDGET_MS / 4 && lod > (dragging ? 1 : 0)) {
+            lod--;
+        }
+        lod = std::min(lod, levels);
+    }
+}
+
+void Canvas::set_load_profile(const LoadProfile& loader_profile)
+{
+    // Counts come from the stages that produced them: the decoder knows
+    // the file size and triangle count, and the weld knows how many
+    // vertices went in and how many unique ones came out.
+    loadInfo = "\n";
+    const auto* decode = loader_profile.stage("decode");
+    const auto* dedup = loader_profile.stage("dedup");
+    const auto* flatten = loader_profile.stage("flatten");
+    if (decode) {
+        loadInfo += QStringLiteral("\nFile: %1 MB").arg(decode->bytes / 1048576.0, 0, 'f', 1);
+    }
+    if (dedup && flatten && flatten->items) {
+        loadInfo += QStringLiteral("\nVertices: %1 (%2:1 dedup)").arg(flatten->items).arg(double(dedup->items) / flatten->items, 0, 'f', 2);
+    }
+
+    qint64 total_ns = 0;
+    qint64 peak_rss = 0;
+    for (const LoadProfile* p : {&loader_profile, &profile}) {
+        for (const auto& stage : p->stages()) {
+            loadInfo += QStringLiteral("\n%1: %2 ms").arg(QLatin1String(stage.name)).arg(stage.duration_ns / 1e6, 0, 'f', 1);
+            if (stage.bytes && stage.duration_ns) {
+                loadInfo += QStringLiteral(", %1 MB/s").arg(stage.bytes * 1e3 / stage.duration_ns, 0, 'f', 0);
+            }
+            total_ns += stage.duration_ns;
+            peak_rss = std::max(peak_rss, stage.peak_rss);
+        }
+    }
+    loadInfo += QStringLiteral("\nTotal: %1 ms").arg(total_ns / 1e6, 0, 'f', 1);
+    if (peak_rss > 0) {
+        loadInfo += QStringLiteral("\nPeak memory: %1 MB").arg(peak_rss / 1048576.0, 0, 'f', 0);
+    }
+    update();
 }
 
 void Canvas::set_status(const QString& s)
@@ -233,62 +622,103 @@ void Canvas::clear_status()
 
 void Canvas::initializeGL()
 {
+    startup.begin("initgl");
     initializeOpenGLFunctions();
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
 
-    mesh_vertshader = new QOpenGLShader(QOpenGLShader::Vertex);
-    mesh_vertshader->compileSourceFile(":/gl/mesh.vert");
-    mesh_shader.addShader(mesh_vertshader);
-    mesh_shader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/mesh.frag");
-    mesh_shader.link();
-    mesh_wireframe_shader.addShader(mesh_vertshader);
-    mesh_wireframe_shader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/mesh_wireframe.frag");
-    mesh_wireframe_shader.link();
-    mesh_surfaceangle_shader.addShader(mesh_vertshader);
-    mesh_surfaceangle_shader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/mesh_surfaceangle.frag");
-    mesh_surfaceangle_shader.link();
-    mesh_meshlight_shader.addShader(mesh_vertshader);
-    mesh_meshlight_shader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/mesh_light.frag");
-    mesh_meshlight_shader.link();
-
+    // Mesh programs are only linked once their draw mode is first used
     backdrop = new Backdrop();
     axis = new Axis();
+
+    // Big meshes are uploaded through a second context on a thread of
+    // its own, which needs the driver to support sharing
+    uploader = new Uploader(context(), this);
+    if (uploader->valid()) {
+        connect(uploader, &Uploader::uploaded, this, &Canvas::on_uploaded);
+    } else {
+        delete uploader;
+        uploader = nullptr;
+    }
+    startup.end();
+}
+
+QOpenGLShaderProgram* Canvas::mesh_program(enum DrawMode mode)
+{
+    if (!mesh_programs[mode]) {
+        // Cacheable shaders let Qt keep the linked binary on disk, keyed
+        // by the sources and the driver, so later starts skip compiling
+        const char* const fragment[] = {":/gl/mesh.frag", ":/gl/mesh_wireframe.frag", ":/gl/mesh_surfaceangle.frag",
+                                        ":/gl/mesh_light.frag"};
+        auto program = new QOpenGLShaderProgram;
+        program->addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/gl/mesh.vert");
+        program->addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, fragment[mode]);
+        program->link();
+        mesh_programs[mode] = program;
+    }
+    return mesh_programs[mode];
 }
 
 void Canvas::paintGL()
+{
+    frame_clock.start();
+    if (!painted) {
+        startup.begin("first frame");
+    }
+
+    // Moving views are drawn at a reduced resolution, and still frames
+    // optionally at double resolution, into an offscreen framebuffer
+    // that's then scaled onto the widget.
+    const qreal dpr = devicePixelRatioF();
+    const QSize full(width() * dpr, height() * dpr);
+    float factor = 1;
+    if (moving()) {
+        factor = adaptiveResolution ? render_scale : 1;
+    } else if (supersampleStill && std::max(full.width(), full.height()) * 2 <= max_texture_size) {
+        factor = 2;
+    }
+
+    if (factor != 1 && QOpenGLFramebufferObject::hasOpenGLFramebufferBlit()) {
+        const QSize size = QSize(full.width() * factor, full.height() * factor).expandedTo(QSize(1, 1));
+        if (!offscreen || offscreen->size() != size) {
+            delete offscreen;
+            offscreen = new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::Depth);
+        }
+        offscreen->bind();
+        glViewport(0, 0, size.width(), size.height());
+        draw_scene();
+        offscreen->release();
+
+        glViewport(0, 0, full.width(), full.height());
+        QOpenGLFramebufferObject::blitFramebuffer(nullptr, QRect(QPoint(), full), offscreen, QRect(QPoint(), size), GL_COLOR_BUFFER_BIT,
+                                                  GL_LINEAR);
+    } else {
+        draw_scene();
+    }
+
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    float textHeight = painter.fontInfo().pointSize();
+    if (drawAxes)
+        painter.drawText(QRect(10, textHeight, width(), height()), meshInfo + loadInfo);
+    painter.drawText(10, height() - textHeight, status);
+}
+
+void Canvas::draw_scene()
 {
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
     backdrop->draw();
-    if (mesh)
+    if (!parts.isEmpty())
         draw_mesh();
     if (drawAxes)
         axis->draw(transform_matrix(), view_matrix(), orient_matrix(), aspect_matrix(), width() / float(height()));
-
-    QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-    float textHeight = painter.fontInfo().pointSize();
-    if (drawAxes)
-        painter.drawText(QRect(10, textHeight, width(), height()), meshInfo);
-    painter.drawText(10, height() - textHeight, status);
 }
 
 void Canvas::draw_mesh()
 {
-    QOpenGLShaderProgram* selected_mesh_shader = NULL;
-    if (drawMode == wireframe) {
-        selected_mesh_shader = &mesh_wireframe_shader;
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    } else {
-        if (drawMode == shaded) {
-            selected_mesh_shader = &mesh_shader;
-        } else if (drawMode == surfaceangle) {
-            selected_mesh_shader = &mesh_surfaceangle_shader;
-        } else if (drawMode == meshlight) {
-            selected_mesh_shader = &mesh_meshlight_shader;
-        }
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    }
+    QOpenGLShaderProgram* selected_mesh_shader = mesh_program(drawMode);
+    glPolygonMode(GL_FRONT_AND_BACK, drawMode == wireframe ? GL_LINE : GL_FILL);
 
     selected_mesh_shader->bind();
 
@@ -328,8 +758,39 @@ void Canvas::draw_mesh()
     const GLuint vp = selected_mesh_shader->attributeLocation("vertex_position");
     glEnableVertexAttribArray(vp);
 
-    // Then draw the mesh with that vertex position
-    mesh->draw(vp);
+    // Then draw each visible part with that vertex position
+    const QMatrix4x4 mvp = view_matrix() * transform_matrix();
+    const GLint offset_location = selected_mesh_shader->uniformLocation("position_offset");
+    const GLint scale_location = selected_mesh_shader->uniformLocation("position_scale");
+    bool paging = false;
+    for (const auto& part : parts) {
+        if (!part.visible) {
+            continue;
+        } else if (part.paged) {
+            // Pages hold plain float positions, and are only read from
+            // disk once the view has settled
+            glUniform3f(offset_location, 0, 0, 0);
+            glUniform3f(scale_location, 1, 1, 1);
+            paging |= part.paged->draw(vp, mvp, !moving());
+            continue;
+        } else if (!part.mesh) {
+            continue;
+        }
+
+        // Draw a coarser level of detail while the view is moving (parts
+        // too small to have any are always drawn in full)
+        GLMesh* drawn = part.mesh;
+        if (interaction.isActive() && lod > 0 && !part.lods.isEmpty()) {
+            drawn = part.lods[std::min(lod, part.lods.size()) - 1];
+        }
+
+        // Decode quantized positions (a no-op for float positions)
+        const QVector3D offset = drawn->position_offset();
+        const QVector3D scale = drawn->position_scale();
+        glUniform3f(offset_location, offset.x(), offset.y(), offset.z());
+        glUniform3f(scale_location, scale.x(), scale.y(), scale.z());
+        drawn->draw(vp, mvp);
+    }
 
     // Reset draw mode for the background and anything else that needs to be drawn
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -337,6 +798,10 @@ void Canvas::draw_mesh()
     // Clean up state machine
     glDisableVertexAttribArray(vp);
     selected_mesh_shader->release();
+
+    if (paging) {
+        update();
+    }
 }
 QMatrix4x4 Canvas::orient_matrix() const
 {
@@ -373,6 +838,7 @@ void Canvas::mousePressEvent(QMouseEvent* event)
     if (event->button() == Qt::LeftButton || event->button() == Qt::RightButton) {
         mouse_pos = event->pos();
         setCursor(Qt::ClosedHandCursor);
+        dragging = true;
     }
 }
 
@@ -380,6 +846,7 @@ void Canvas::mouseReleaseEvent(QMouseEvent* event)
 {
     if (event->button() == Qt::LeftButton || event->button() == Qt::RightButton) {
         unsetCursor();
+        dragging = false;
     }
 }
 
@@ -448,10 +915,12 @@ void Canvas::mouseMoveEvent(QMouseEvent* event)
         QPointF p2r = changeMouseCoordinates(p);
         calcArcballTransform(p1r, p2r);
 
+        interact();
         update();
     } else if (event->buttons() & Qt::RightButton) {
         center = transform_matrix().inverted() * view_matrix().inverted() *
                  QVector3D(-d.x() / (0.5 * width()), d.y() / (0.5 * height()), 0);
+        interact();
         update();
     }
     mouse_pos = p;
@@ -482,6 +951,7 @@ void Canvas::wheelEvent(QWheelEvent* event)
     // Then find the cursor's GL position post-zoom and adjust center.
     QVector3D b = transform_matrix().inverted() * view_matrix().inverted() * v;
     center += b - a;
+    interact();
     update();
 }
 
@@ -5,8 +5,15 @@
 #include <QSurfaceFormat>
 #include <QtOpenGL>
 
+#include "loadprofile.h"
+
 class GLMesh;
+class GLPagedMesh;
 class Mesh;
+struct MeshPatch;
+class PagedMesh;
+class Uploader;
+struct MeshStats;
 class Backdrop;
 class Axis;
 
@@ -27,6 +34,10 @@ public:
     void view_perspective(float p, bool animate);
     void draw_axes(bool d);
     void invert_zoom(bool d);
+    /*  Renders at a reduced resolution while the view is moving */
+    void adaptive_resolution(bool d);
+    /*  Renders still frames at twice the resolution and downsamples them */
+    void supersample(bool d);
     void set_drawMode(enum DrawMode mode);
     void common_view_change(enum ViewPoint c);
     void setResetTransformOnLoad(bool d);
@@ -51,7 +62,24 @@ public:
 public slots:
     void set_status(const QString& s);
     void clear_status();
-    void load_mesh(Mesh* m, bool is_reload);
+    /*  Starts a scene of the given number of parts, which are filled in
+     *  by load_mesh as they arrive */
+    void begin_scene(int count, bool is_reload);
+    void load_mesh(Mesh* m, bool is_reload, int part = 0);
+    /*  Loads a mesh that's paged from disk as it comes into view */
+    void load_paged_mesh(PagedMesh* m, bool is_reload, int part = 0);
+    /*  Writes new vertex positions into a part's uploaded mesh, dropping
+     *  its levels of detail until new ones arrive.  Returns false (and
+     *  leaves the part alone) if the part has no uploaded mesh to patch.
+     *  Either way, this takes ownership of the patch. */
+    bool patch_mesh(MeshPatch* patch, int part = 0);
+    /*  Identifies the mesh most recently loaded into a part, or 0 if the
+     *  part has none */
+    quint64 part_serial(int part) const;
+    /*  Adds the next coarser level of detail for one part's mesh */
+    void add_lod(Mesh* m, int part = 0);
+    void set_part_visible(int part, bool visible);
+    void set_load_profile(const LoadProfile& loader_profile);
 
 protected:
     void paintGL() override;
@@ -66,8 +94,22 @@ protected:
     void set_perspective(float p);
     void view_anim(float v);
 
+private slots:
+    void on_frame_swapped();
+    void on_uploaded(GLMesh* mesh, quint64 tag);
+
 private:
+    void draw_scene();
     void draw_mesh();
+    /*  Updates the overlay text with the loaded parts' details */
+    void update_mesh_info();
+    /*  Returns the largest number of levels of detail of any part */
+    int lod_levels() const;
+    /*  Whether the view is being dragged, zoomed or animated */
+    bool moving() const;
+    /*  Marks the view as moving, so that coarser levels of detail are
+     *  drawn until it has settled */
+    void interact();
 
     QMatrix4x4 orient_matrix() const;
     QMatrix4x4 transform_matrix() const;
@@ -77,11 +119,10 @@ private:
     QPointF changeMouseCoordinates(QPoint p);
     void calcArcballTransform(QPointF p1, QPointF p2);
 
-    QOpenGLShader* mesh_vertshader;
-    QOpenGLShaderProgram mesh_shader;
-    QOpenGLShaderProgram mesh_wireframe_shader;
-    QOpenGLShaderProgram mesh_surfaceangle_shader;
-    QOpenGLShaderProgram mesh_meshlight_shader;
+    /*  Returns the program for a draw mode, linking it the first time
+     *  that mode is drawn */
+    QOpenGLShaderProgram* mesh_program(enum DrawMode mode);
+    QOpenGLShaderProgram* mesh_programs[DRAWMODECOUNT];
 
     QColor ambientColor;
     QColor directiveColor;
@@ -102,7 +143,55 @@ private:
     const static QString DIRECTIVE_FACTOR;
     const static QString CURRENT_LIGHT_DIRECTION;
 
-    GLMesh* mesh;
+    /*  One mesh of the scene, with its levels of detail, or else a mesh
+     *  that's paged from disk.  A part is loaded once its bounds and info
+     *  are known, which may be before its mesh has been uploaded. */
+    struct Part {
+        GLMesh* mesh = nullptr;
+        QVector<GLMesh*> lods;
+        GLPagedMesh* paged = nullptr;
+        QVector3D lower, upper;
+        qint64 tri_count = 0;
+        float quantization_error = 0;
+        QString info;
+        bool visible = true;
+        bool loaded = false;
+
+        /*  Identifies the latest mesh loaded into this part, along with
+         *  how many of its uploads are still in flight */
+        quint64 serial = 0;
+        int uploads = 0;
+    };
+    /*  Frees a part's levels of detail and paged mesh, replacing the
+     *  whole scene first if a new one is pending, and returns it ready
+     *  for a new mesh.  The old mesh stays until its replacement has
+     *  been uploaded. */
+    Part& reset_part(int part);
+    /*  Uploads a mesh (or a level of detail) for a part, taking ownership
+     *  of it.  Big meshes, and any that would otherwise overtake one of
+     *  them, go through the upload thread. */
+    void upload(Mesh* m, int part, bool lod);
+    /*  Recomputes the scene's bounds once a part has been loaded, and
+     *  fits the camera to them if this isn't a reload */
+    void update_scene(bool is_reload, bool first);
+    /*  Describes a part's size and statistics */
+    static QString part_info(const Part& p, const MeshStats* stats);
+    QVector<Part> parts;
+    Uploader* uploader;
+    quint64 upload_serial;
+    /*  Parts and serials that queued uploads are meant for, along with
+     *  the page of the part's paged mesh if it's a page */
+    struct Upload {
+        int part;
+        quint64 serial;
+        bool lod;
+        int page;
+    };
+    QHash<quint64, Upload> uploads;
+    const static size_t ASYNC_UPLOAD_BYTES = 64 << 20;
+    int scene_size;
+    bool scene_pending;
+    QVector3D scene_lower, scene_upper;
     Backdrop* backdrop;
     Axis* axis;
 
@@ -120,8 +209,27 @@ private:
     QPropertyAnimation anim;
 
     QPoint mouse_pos;
+    bool dragging;
+    QTimer interaction;
+    QElapsedTimer frame_clock;
+    qint64 frame_ms;
+    int lod;
+    const static int FRAME_BUDGET_MS = 33;
+
+    bool adaptiveResolution;
+    bool supersampleStill;
+    float render_scale;
+    GLint max_texture_size;
+    QOpenGLFramebufferObject* offscreen;
+    const static float MIN_RENDER_SCALE;
+    const static int SETTLE_MS = 200;
     QString status;
     QString meshInfo;
+    QString loadInfo;
+    LoadProfile profile;
+    /*  Times from the canvas being made to its first frame on screen */
+    LoadProfile startup;
+    bool painted;
 };
 
 #endif // CANVAS_H
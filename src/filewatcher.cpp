@@ -0,0 +1,117 @@
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include "filewatcher.h"
+
+#ifdef Q_OS_LINUX
+#    include <sys/inotify.h>
+#    include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(QObject* parent) :
+    QObject(parent), inotify_fd(-1), inotify_watch(-1), notifier(nullptr), fallback(nullptr), settle_timer(nullptr), settle_size(-1)
+{
+#ifdef Q_OS_LINUX
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0) {
+        notifier = new QSocketNotifier(inotify_fd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, &FileWatcher::on_inotify);
+        return;
+    }
+#endif
+
+    fallback = new QFileSystemWatcher(this);
+    connect(fallback, &QFileSystemWatcher::fileChanged, this, &FileWatcher::on_fallback_change);
+
+    settle_timer = new QTimer(this);
+    settle_timer->setSingleShot(true);
+    settle_timer->setInterval(100);
+    connect(settle_timer, &QTimer::timeout, this, &FileWatcher::on_fallback_settled);
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+#endif
+}
+
+void FileWatcher::set_path(const QString& path)
+{
+    const QFileInfo info(path);
+    watched_path = path;
+    watched_name = info.fileName();
+
+#ifdef Q_OS_LINUX
+    if (inotify_fd >= 0) {
+        if (inotify_watch >= 0) {
+            inotify_rm_watch(inotify_fd, inotify_watch);
+        }
+        // Watch the directory rather than the file itself, so that the
+        // watch survives the file being replaced by a rename.
+        const QByteArray dir = QFile::encodeName(info.absolutePath());
+        inotify_watch = inotify_add_watch(inotify_fd, dir.constData(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        return;
+    }
+#endif
+
+    const auto files = fallback->files();
+    if (files.size()) {
+        fallback->removePaths(files);
+    }
+    fallback->addPath(path);
+}
+
+QString FileWatcher::path() const
+{
+    return watched_path;
+}
+
+void FileWatcher::on_inotify()
+{
+#ifdef Q_OS_LINUX
+    // A single save can produce several events (e.g. an editor that
+    // rewrites the file twice), so report at most one change per batch.
+    bool saved = false;
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len;) {
+            const auto event = reinterpret_cast<const struct inotify_event*>(p);
+            if (event->wd == inotify_watch && event->len && watched_name == QFile::decodeName(event->name)) {
+                saved = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (saved) {
+        emit changed(watched_path);
+    }
+#endif
+}
+
+void FileWatcher::on_fallback_change()
+{
+    // Saving by renaming a new file into place drops the watch
+    if (!fallback->files().contains(watched_path) && QFileInfo::exists(watched_path)) {
+        fallback->addPath(watched_path);
+    }
+    settle_size = -1;
+    settle_timer->start();
+}
+
+void FileWatcher::on_fallback_settled()
+{
+    // Keep waiting until the file's size stops changing
+    const qint64 size = QFileInfo(watched_path).size();
+    if (size != settle_size) {
+        settle_size = size;
+        settle_timer->start();
+    } else {
+        emit changed(watched_path);
+    }
+}
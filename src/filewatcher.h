@@ -0,0 +1,49 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <QObject>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+class QTimer;
+
+/*
+ *  Watches a single file and emits changed() once per completed save.
+ *
+ *  On Linux, this uses inotify on the file's directory to catch the file
+ *  being closed after writing or renamed into place (as editors do for
+ *  atomic saves).  Elsewhere, it falls back to QFileSystemWatcher and
+ *  waits for the file to stop changing.
+ */
+class FileWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileWatcher(QObject* parent);
+    ~FileWatcher();
+
+    void set_path(const QString& path);
+    QString path() const;
+
+signals:
+    void changed(const QString& path);
+
+private slots:
+    void on_inotify();
+    void on_fallback_change();
+    void on_fallback_settled();
+
+private:
+    QString watched_path;
+    QString watched_name;
+
+    int inotify_fd;
+    int inotify_watch;
+    QSocketNotifier* notifier;
+
+    QFileSystemWatcher* fallback;
+    QTimer* settle_timer;
+    qint64 settle_size;
+};
+
+#endif // FILEWATCHER_H
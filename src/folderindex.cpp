@@ -0,0 +1,235 @@
+#include <QDirIterator>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+
+#include <algorithm>
+
+#include "folderindex.h"
+
+#ifdef Q_OS_LINUX
+#    include <sys/inotify.h>
+#    include <unistd.h>
+#endif
+
+/*  Lists and sorts a folder's files off the GUI thread */
+class FolderIndex::Scan : public QThread
+{
+public:
+    Scan(QObject* parent, const QString& path) : QThread(parent), path(path) {}
+
+    void run() override
+    {
+        // Comparing sort keys is much cheaper than comparing the names
+        // with the collator, so every key is computed once up front and
+        // the folder is then sorted in one go.
+        QCollator collator;
+        collator.setNumericMode(true);
+        QDirIterator dirIterator(path, QStringList() << "*.stl", QDir::Files | QDir::Readable | QDir::Hidden);
+        while (dirIterator.hasNext() && !isInterruptionRequested()) {
+            dirIterator.next();
+            const QString name = dirIterator.fileName();
+            entries.push_back({collator.sortKey(name), name});
+        }
+        std::sort(entries.begin(), entries.end(), FolderIndex::before);
+    }
+
+    const QString path;
+    std::vector<Entry> entries;
+};
+
+FolderIndex::FolderIndex(QObject* parent) :
+    QObject(parent), scanned(false), inotify_fd(-1), inotify_watch(-1), notifier(nullptr), fallback(nullptr)
+{
+    collator.setNumericMode(true);
+
+#ifdef Q_OS_LINUX
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0) {
+        notifier = new QSocketNotifier(inotify_fd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, &FolderIndex::on_inotify);
+        return;
+    }
+#endif
+
+    fallback = new QFileSystemWatcher(this);
+    connect(fallback, &QFileSystemWatcher::directoryChanged, this, &FolderIndex::on_fallback_change);
+}
+
+FolderIndex::~FolderIndex()
+{
+    if (scanner) {
+        scanner->requestInterruption();
+        scanner->wait();
+    }
+#ifdef Q_OS_LINUX
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+#endif
+}
+
+bool FolderIndex::before(const Entry& a, const Entry& b)
+{
+    // Names that collate equally (such as "1.stl" and "01.stl" in
+    // numeric mode) still need a fixed order
+    const int c = a.key.compare(b.key);
+    return c < 0 || (c == 0 && a.name < b.name);
+}
+
+bool FolderIndex::matches(const QString& name)
+{
+    return name.endsWith(".stl", Qt::CaseInsensitive);
+}
+
+void FolderIndex::set_folder(const QString& path)
+{
+    if (path == folder_path) {
+        return;
+    }
+    folder_path = path;
+    entries.clear();
+    scanned = false;
+
+#ifdef Q_OS_LINUX
+    if (inotify_fd >= 0) {
+        if (inotify_watch >= 0) {
+            inotify_rm_watch(inotify_fd, inotify_watch);
+        }
+        const QByteArray dir = QFile::encodeName(path);
+        inotify_watch = inotify_add_watch(inotify_fd, dir.constData(), IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+    }
+#endif
+    if (fallback) {
+        const auto dirs = fallback->directories();
+        if (dirs.size()) {
+            fallback->removePaths(dirs);
+        }
+        fallback->addPath(path);
+    }
+
+    scan();
+}
+
+QString FolderIndex::folder() const
+{
+    return folder_path;
+}
+
+bool FolderIndex::ready() const
+{
+    return scanned;
+}
+
+int FolderIndex::size() const
+{
+    return entries.size();
+}
+
+QString FolderIndex::at(int i) const
+{
+    return entries[i].name;
+}
+
+int FolderIndex::index_of(const QString& name) const
+{
+    const auto it = find({collator.sortKey(name), name});
+    return (it != entries.end() && it->name == name) ? it - entries.begin() : -1;
+}
+
+std::vector<FolderIndex::Entry>::const_iterator FolderIndex::find(const Entry& entry) const
+{
+    return std::lower_bound(entries.begin(), entries.end(), entry, before);
+}
+
+void FolderIndex::scan()
+{
+    // Only the newest scan's results are used
+    if (scanner) {
+        scanner->requestInterruption();
+    }
+    pending.clear();
+
+    scanner = new Scan(this, folder_path);
+    connect(scanner, &QThread::finished, this, &FolderIndex::on_scanned);
+    connect(scanner, &QThread::finished, scanner, &QThread::deleteLater);
+    scanner->start();
+}
+
+void FolderIndex::on_scanned()
+{
+    if (sender() != scanner.data()) {
+        return;
+    }
+    entries = std::move(static_cast<Scan*>(scanner.data())->entries);
+    scanner = nullptr;
+    scanned = true;
+
+    for (const auto& change : pending) {
+        if (change.second) {
+            insert(change.first);
+        } else {
+            remove(change.first);
+        }
+    }
+    pending.clear();
+    emit indexed();
+}
+
+void FolderIndex::insert(const QString& name)
+{
+    const Entry entry = {collator.sortKey(name), name};
+    const auto it = find(entry);
+    if (it == entries.end() || it->name != name) {
+        entries.insert(it, entry);
+    }
+}
+
+void FolderIndex::remove(const QString& name)
+{
+    const auto it = find({collator.sortKey(name), name});
+    if (it != entries.end() && it->name == name) {
+        entries.erase(it);
+    }
+}
+
+void FolderIndex::on_inotify()
+{
+#ifdef Q_OS_LINUX
+    bool overflow = false;
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len;) {
+            const auto event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            // Events were dropped, so the index can't be patched up
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            const QString name = event->len ? QFile::decodeName(event->name) : QString();
+            if (event->wd != inotify_watch || (event->mask & IN_ISDIR) || !matches(name)) {
+                continue;
+            }
+
+            const bool added = event->mask & (IN_CREATE | IN_MOVED_TO);
+            if (scanner) {
+                pending.append(qMakePair(name, added));
+            } else if (added) {
+                insert(name);
+            } else {
+                remove(name);
+            }
+        }
+    }
+    if (overflow) {
+        scan();
+    }
+#endif
+}
+
+void FolderIndex::on_fallback_change()
+{
+    scan();
+}
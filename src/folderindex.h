@@ -0,0 +1,84 @@
+#ifndef FOLDERINDEX_H
+#define FOLDERINDEX_H
+
+#include <QCollator>
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+#include <vector>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+/*
+ *  A naturally sorted list of the .stl files in a folder, used to step
+ *  through the folder's files.
+ *
+ *  The folder is scanned on a background thread and sorted once by
+ *  precomputed collation keys.  After that, on Linux, inotify events on
+ *  the folder insert and remove single files.  Elsewhere, any change to
+ *  the folder starts a new background scan.
+ */
+class FolderIndex : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FolderIndex(QObject* parent);
+    ~FolderIndex();
+
+    /*  Starts indexing a folder, unless it's the folder already indexed */
+    void set_folder(const QString& path);
+    QString folder() const;
+
+    /*  Whether the folder has been scanned; until then, it looks empty */
+    bool ready() const;
+
+    int size() const;
+    QString at(int i) const;
+    /*  Returns the position of a file name in the folder, or -1 */
+    int index_of(const QString& name) const;
+
+signals:
+    /*  Emitted when a scan of the folder has finished */
+    void indexed();
+
+private slots:
+    void on_scanned();
+    void on_inotify();
+    void on_fallback_change();
+
+private:
+    struct Entry {
+        QCollatorSortKey key;
+        QString name;
+    };
+    class Scan;
+    static bool before(const Entry& a, const Entry& b);
+    static bool matches(const QString& name);
+
+    void scan();
+    void insert(const QString& name);
+    void remove(const QString& name);
+    /*  Returns the first entry that doesn't sort before the given one */
+    std::vector<Entry>::const_iterator find(const Entry& entry) const;
+
+    QString folder_path;
+    std::vector<Entry> entries;
+    bool scanned;
+    QCollator collator;
+
+    /*  Files added (true) or removed (false) while a scan is running,
+     *  which are applied in order once it finishes */
+    QVector<QPair<QString, bool>> pending;
+    QPointer<QThread> scanner;
+
+    int inotify_fd;
+    int inotify_watch;
+    QSocketNotifier* notifier;
+    QFileSystemWatcher* fallback;
+};
+
+#endif // FOLDERINDEX_H
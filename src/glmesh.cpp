@@ -1,33 +1,204 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include "glmesh.h"
 #include "mesh.h"
 
-GLMesh::GLMesh(const Mesh* const mesh) : vertices(QOpenGLBuffer::VertexBuffer), indices(QOpenGLBuffer::IndexBuffer)
+namespace
+{
+/*  Fills the bound buffer a slice at a time, so that the driver never has
+ *  to stage a whole multi-gigabyte array at once */
+void fill(QOpenGLBuffer& buffer, const void* data, size_t size)
+{
+    const size_t SLICE = 16 << 20;
+    buffer.allocate(int(size));
+    for (size_t offset = 0; offset < size; offset += SLICE) {
+        buffer.write(int(offset), static_cast<const char*>(data) + offset, int(std::min(SLICE, size - offset)));
+    }
+}
+} // namespace
+
+GLMesh::GLMesh(const Mesh* const mesh) :
+    vertices(QOpenGLBuffer::VertexBuffer),
+    indices(QOpenGLBuffer::IndexBuffer),
+    quantized(mesh->quantized()),
+    vertex_count(mesh->vertexCount()),
+    offset(mesh->positionOffset()),
+    scale(mesh->positionScale()),
+    index_type(GL_UNSIGNED_INT)
 {
     initializeOpenGLFunctions();
 
     vertices.create();
-    indices.create();
-
     vertices.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    indices.setUsagePattern(QOpenGLBuffer::StaticDraw);
-
     vertices.bind();
-    vertices.allocate(mesh->vertices.data(), mesh->vertices.size() * sizeof(float));
+    fill(vertices, mesh->vertexBuffer(), mesh->vertexBufferSize());
     vertices.release();
 
-    indices.bind();
-    indices.allocate(mesh->indices.data(), mesh->indices.size() * sizeof(uint32_t));
-    indices.release();
+    // Triangle soups are drawn straight from the vertex buffer.  Meshes
+    // that haven't been chunked are drawn as one chunk with 32-bit indices.
+    if (mesh->indexed()) {
+        indices.create();
+        indices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        indices.bind();
+        fill(indices, mesh->indexBuffer(), mesh->indexBufferSize());
+        indices.release();
+
+        chunks = mesh->chunks();
+        tree = mesh->chunkTree();
+        if (chunks.empty()) {
+            chunks.push_back({0, GLuint(vertex_count), 0, GLuint(mesh->triCount() * 3)});
+            index_type = GL_UNSIGNED_INT;
+        } else {
+            index_type = GL_UNSIGNED_SHORT;
+        }
+    }
+}
+
+void GLMesh::adopt()
+{
+    initializeOpenGLFunctions();
+}
+
+void GLMesh::vertex_pointer(GLuint vp, GLuint first_vertex)
+{
+    if (quantized) {
+        // Normalized, so the shader sees each coordinate in [0, 1]
+        const size_t stride = 3 * sizeof(GLushort);
+        glVertexAttribPointer(vp, 3, GL_UNSIGNED_SHORT, true, stride, reinterpret_cast<void*>(first_vertex * stride));
+    } else {
+        const size_t stride = 3 * sizeof(GLfloat);
+        glVertexAttribPointer(vp, 3, GL_FLOAT, false, stride, reinterpret_cast<void*>(first_vertex * stride));
+    }
+}
+
+int GLMesh::clip_box(const QMatrix4x4& mvp, const float lower[3], const float upper[3])
+{
+    int outside[6] = {0, 0, 0, 0, 0, 0};
+    bool inside = true;
+    for (int corner = 0; corner < 8; ++corner) {
+        const QVector4D c = mvp * QVector4D(corner & 1 ? upper[0] : lower[0], corner & 2 ? upper[1] : lower[1],
+                                            corner & 4 ? upper[2] : lower[2], 1);
+        const bool out[6] = {c.x() < -c.w(), c.x() > c.w(), c.y() < -c.w(), c.y() > c.w(), c.z() < -c.w(), c.z() > c.w()};
+        for (int plane = 0; plane < 6; ++plane) {
+            outside[plane] += out[plane];
+            inside &= !out[plane];
+        }
+    }
+    for (int plane = 0; plane < 6; ++plane) {
+        if (outside[plane] == 8) {
+            return -1;
+        }
+    }
+    return inside ? 1 : 0;
 }
 
-void GLMesh::draw(GLuint vp)
+void GLMesh::draw_chunks(GLuint vp, GLuint first, GLuint count)
+{
+    const size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    for (GLuint c = first; c < first + count; ++c) {
+        vertex_pointer(vp, chunks[c].first_vertex);
+        glDrawElements(GL_TRIANGLES, chunks[c].index_count, index_type, reinterpret_cast<void*>(chunks[c].first_index * index_size));
+    }
+}
+
+void GLMesh::draw(GLuint vp, const QMatrix4x4& mvp)
 {
     vertices.bind();
-    indices.bind();
 
-    glVertexAttribPointer(vp, 3, GL_FLOAT, false, 3 * sizeof(float), NULL);
-    glDrawElements(GL_TRIANGLES, indices.size() / sizeof(uint32_t), GL_UNSIGNED_INT, NULL);
+    if (indices.isCreated()) {
+        indices.bind();
+        if (tree.empty()) {
+            draw_chunks(vp, 0, chunks.size());
+        } else {
+            // Walk the tree, skipping subtrees that are entirely off screen
+            // and drawing those that are entirely on screen without testing
+            // their children.
+            size_t i = 0;
+            while (i < tree.size()) {
+                const ChunkNode& node = tree[i];
+                const int clip = clip_box(mvp, node.lower, node.upper);
+                if (clip < 0) {
+                    i = node.skip;
+                } else if (clip > 0 || node.chunk_count == 1) {
+                    draw_chunks(vp, node.first_chunk, node.chunk_count);
+                    i = node.skip;
+                } else {
+                    i++;
+                }
+            }
+        }
+        indices.release();
+    } else {
+        vertex_pointer(vp, 0);
+        glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+    }
 
     vertices.release();
-    indices.release();
+}
+
+void GLMesh::patch(const std::vector<GLuint>& slots, const std::vector<GLfloat>& xyz)
+{
+    float inverse[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        inverse[axis] = scale[axis] > 0 ? 65535 / scale[axis] : 0;
+    }
+
+    // Runs of consecutive vertices are written with one call each
+    const size_t stride = quantized ? 3 * sizeof(GLushort) : 3 * sizeof(GLfloat);
+    std::vector<char> run;
+    vertices.bind();
+    for (size_t i = 0; i < slots.size();) {
+        size_t end = i + 1;
+        while (end < slots.size() && slots[end] == slots[end - 1] + 1) {
+            end++;
+        }
+        run.resize((end - i) * stride);
+        if (quantized) {
+            GLushort* out = reinterpret_cast<GLushort*>(run.data());
+            for (size_t j = i * 3; j < end * 3; ++j) {
+                const float q = (xyz[j] - offset[j % 3]) * inverse[j % 3] + 0.5f;
+                *out++ = q >= 65535 ? 65535 : (q > 0 ? GLushort(q) : 0);
+            }
+        } else {
+            memcpy(run.data(), &xyz[i * 3], run.size());
+        }
+        vertices.write(int(slots[i] * stride), run.data(), int(run.size()));
+        i = end;
+    }
+    vertices.release();
+
+    // Grow the bounds of each patched vertex's chunk, then of the tree
+    // nodes above them
+    for (size_t i = 0; i < slots.size(); ++i) {
+        auto c = std::upper_bound(chunks.begin(), chunks.end(), slots[i],
+                                  [](GLuint slot, const MeshChunk& chunk) { return slot < chunk.first_vertex; });
+        if (c == chunks.begin()) {
+            continue;
+        }
+        --c;
+        for (int axis = 0; axis < 3; ++axis) {
+            c->lower[axis] = fmin(c->lower[axis], xyz[i * 3 + axis]);
+            c->upper[axis] = fmax(c->upper[axis], xyz[i * 3 + axis]);
+        }
+    }
+    for (auto& node : tree) {
+        for (GLuint c = node.first_chunk; c < node.first_chunk + node.chunk_count; ++c) {
+            for (int axis = 0; axis < 3; ++axis) {
+                node.lower[axis] = fmin(node.lower[axis], chunks[c].lower[axis]);
+                node.upper[axis] = fmax(node.upper[axis], chunks[c].upper[axis]);
+            }
+        }
+    }
+}
+
+QVector3D GLMesh::position_offset() const
+{
+    return offset;
+}
+
+QVector3D GLMesh::position_scale() const
+{
+    return scale;
 }
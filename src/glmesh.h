@@ -2,20 +2,55 @@
 #define GLMESH_H
 
 #include <QOpenGLBuffer>
+#include <QMatrix4x4>
 #include <QOpenGLFunctions>
+#include <QVector3D>
 
-// forward declaration
-class Mesh;
+#include "mesh.h"
 
 class GLMesh : protected QOpenGLFunctions
 {
 public:
     GLMesh(const Mesh* const mesh);
-    void draw(GLuint vp);
+
+    /*  Resolves OpenGL functions for the current context, which a mesh
+     *  that was uploaded through another (sharing) context needs before
+     *  it can be drawn */
+    void adopt();
+
+    /*  Draws the mesh, skipping any chunks that fall outside the clip
+     *  volume of the given model-view-projection matrix */
+    void draw(GLuint vp, const QMatrix4x4& mvp);
+
+    /*  Overwrites the positions of the given vertices (in ascending order,
+     *  with xyz positions to match), growing the bounds of their chunks to
+     *  fit.  Positions are quantized to the existing offset and scale. */
+    void patch(const std::vector<GLuint>& slots, const std::vector<GLfloat>& xyz);
+
+    /*  Uniforms that mesh.vert needs to decode the stored positions */
+    QVector3D position_offset() const;
+    QVector3D position_scale() const;
+
+    /*  Returns -1 if a box lies entirely outside the clip volume, 1 if it
+     *  lies entirely inside, or 0 if it straddles the boundary */
+    static int clip_box(const QMatrix4x4& mvp, const float lower[3], const float upper[3]);
 
 private:
+    /*  Points the vertex attribute at the given vertex, which stands in
+     *  for the base vertex parameter that OpenGL 2.1 lacks */
+    void vertex_pointer(GLuint vp, GLuint first_vertex);
+    void draw_chunks(GLuint vp, GLuint first, GLuint count);
+
     QOpenGLBuffer vertices;
     QOpenGLBuffer indices;
+
+    bool quantized;
+    GLsizei vertex_count;
+    QVector3D offset, scale;
+
+    std::vector<MeshChunk> chunks;
+    std::vector<ChunkNode> tree;
+    GLenum index_type;
 };
 
 #endif // GLMESH_H
@@ -0,0 +1,147 @@
+#include <QElapsedTimer>
+#include <QSettings>
+
+#include <algorithm>
+
+#include "glmesh.h"
+#include "glpagedmesh.h"
+#include "pagedmesh.h"
+
+const QString GLPagedMesh::PAGE_BUDGET_KEY = "pageBudgetMB";
+
+GLPagedMesh::GLPagedMesh(PagedMesh* mesh, const Fetch& fetch) : source(mesh), fetch(fetch), used(0), frame(0), in_flight(0)
+{
+    initializeOpenGLFunctions();
+    budget = QSettings().value(PAGE_BUDGET_KEY, 1024).toLongLong() << 20;
+
+    // The overviews are uploaded once and never evicted, so their copies
+    // in memory can go straight away
+    const size_t count = source->pages().size();
+    overview.resize(count, nullptr);
+    pages.resize(count, nullptr);
+    state.resize(count, absent);
+    last_drawn.resize(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        if (Mesh* m = source->takeOverview(i)) {
+            overview[i] = new GLMesh(m);
+            delete m;
+        }
+    }
+}
+
+GLPagedMesh::~GLPagedMesh()
+{
+    qDeleteAll(overview);
+    qDeleteAll(pages);
+}
+
+qint64 GLPagedMesh::page_bytes(size_t page) const
+{
+    return source->pages()[page].tri_count * 3 * sizeof(Vertex);
+}
+
+bool GLPagedMesh::make_room(qint64 bytes)
+{
+    while (used + bytes > budget) {
+        size_t oldest = pages.size();
+        for (size_t i = 0; i < pages.size(); ++i) {
+            if (state[i] == resident && last_drawn[i] < frame && (oldest == pages.size() || last_drawn[i] < last_drawn[oldest])) {
+                oldest = i;
+            }
+        }
+        if (oldest == pages.size()) {
+            return false;
+        }
+        delete pages[oldest];
+        pages[oldest] = nullptr;
+        state[oldest] = absent;
+        used -= page_bytes(oldest);
+    }
+    return true;
+}
+
+void GLPagedMesh::add_page(size_t page, GLMesh* mesh)
+{
+    in_flight--;
+    if (mesh) {
+        pages[page] = mesh;
+        state[page] = resident;
+        last_drawn[page] = frame;
+    } else {
+        state[page] = unreadable;
+        used -= page_bytes(page);
+    }
+}
+
+bool GLPagedMesh::draw(GLuint vp, const QMatrix4x4& mvp, bool load_pages)
+{
+    frame++;
+    const auto& list = source->pages();
+    std::vector<std::pair<float, size_t>> wanted;
+    for (size_t i = 0; i < list.size(); ++i) {
+        const PagedMesh::Page& page = list[i];
+        if (GLMesh::clip_box(mvp, page.lower, page.upper) < 0) {
+            continue;
+        }
+        if (state[i] == resident) {
+            pages[i]->draw(vp, mvp);
+            last_drawn[i] = frame;
+            continue;
+        } else if (overview[i]) {
+            overview[i]->draw(vp, mvp);
+        }
+        if (state[i] == absent) {
+            const QVector4D c = mvp * QVector4D((page.lower[0] + page.upper[0]) / 2, (page.lower[1] + page.upper[1]) / 2,
+                                               (page.lower[2] + page.upper[2]) / 2, 1);
+            wanted.push_back({c.w(), i});
+        }
+    }
+    if (!load_pages || wanted.empty()) {
+        return false;
+    }
+
+    // Pages show up from the next frame on, since their overviews were
+    // already drawn.  Fetched pages are read and uploaded off the GUI
+    // thread, and trigger a redraw as they arrive, so only a few are asked
+    // for at a time, to keep up with a view that's moving on.  Otherwise,
+    // pages are read here for a bounded time each frame, so that the view
+    // stays responsive while the rest of them stream in.
+    std::sort(wanted.begin(), wanted.end());
+    QElapsedTimer timer;
+    timer.start();
+    bool uploaded = false;
+    for (const auto& w : wanted) {
+        if (fetch ? in_flight >= MAX_FETCHING : timer.elapsed() > PAGE_IN_MS) {
+            return !fetch;
+        }
+        const size_t i = w.second;
+        const qint64 bytes = page_bytes(i);
+        if (bytes > budget) {
+            // Pages that could never fit are left as overviews
+            state[i] = unreadable;
+            continue;
+        } else if (!make_room(bytes)) {
+            break;
+        }
+        used += bytes;
+
+        if (fetch) {
+            state[i] = fetching;
+            in_flight++;
+            fetch(source, i);
+            continue;
+        }
+        QSharedPointer<Soup> verts(new Soup);
+        if (!source->readPage(i, *verts)) {
+            state[i] = unreadable;
+            used -= bytes;
+            continue;
+        }
+        const Mesh m(verts);
+        pages[i] = new GLMesh(&m);
+        state[i] = resident;
+        last_drawn[i] = frame;
+        uploaded = true;
+    }
+    return uploaded;
+}
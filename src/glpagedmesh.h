@@ -0,0 +1,73 @@
+#ifndef GLPAGEDMESH_H
+#define GLPAGEDMESH_H
+
+#include <QMatrix4x4>
+#include <QOpenGLFunctions>
+#include <QSharedPointer>
+
+#include <functional>
+#include <vector>
+
+class GLMesh;
+class PagedMesh;
+
+/*
+ *  Draws a PagedMesh, keeping the pages that are in view on the GPU in
+ *  full (within a memory budget) and drawing every other page from its
+ *  overview.
+ */
+class GLPagedMesh : protected QOpenGLFunctions
+{
+public:
+    /*  Starts reading and uploading a page somewhere other than the GUI
+     *  thread, which hands the result back through add_page */
+    typedef std::function<void(const QSharedPointer<PagedMesh>& source, size_t page)> Fetch;
+
+    /*  Uploads the overview of every page, and takes ownership of mesh.
+     *  Without a fetch function, pages are read and uploaded in draw. */
+    GLPagedMesh(PagedMesh* mesh, const Fetch& fetch = Fetch());
+    ~GLPagedMesh();
+
+    /*  Draws the pages that fall inside the clip volume.  If load_pages
+     *  is set, pages in view are also fetched (the nearest first, with up
+     *  to MAX_FETCHING at a time), evicting the pages that went longest
+     *  without being drawn to stay within the budget.  Without a fetch
+     *  function, they're read and uploaded here for up to PAGE_IN_MS.
+     *
+     *  Returns true if another frame should be drawn, either to show the
+     *  pages that were uploaded or to carry on uploading. */
+    bool draw(GLuint vp, const QMatrix4x4& mvp, bool load_pages);
+
+    /*  Takes ownership of a fetched page, or gives up on the page if mesh
+     *  is NULL because it couldn't be read */
+    void add_page(size_t page, GLMesh* mesh);
+
+    /*  Settings key for the GPU memory budget, in megabytes */
+    const static QString PAGE_BUDGET_KEY;
+
+private:
+    /*  Evicts pages until there's room for the given number of bytes,
+     *  returning false if that would mean evicting a page in view */
+    bool make_room(qint64 bytes);
+    qint64 page_bytes(size_t page) const;
+
+    enum PageState { absent, fetching, resident, unreadable };
+
+    QSharedPointer<PagedMesh> source;
+    const Fetch fetch;
+    std::vector<GLMesh*> overview;
+    std::vector<GLMesh*> pages;
+    std::vector<PageState> state;
+    std::vector<quint64> last_drawn;
+
+    /*  Bytes of pages that are resident or being fetched */
+    qint64 budget;
+    qint64 used;
+    quint64 frame;
+    int in_flight;
+
+    const static int PAGE_IN_MS = 10;
+    const static int MAX_FETCHING = 4;
+};
+
+#endif // GLPAGEDMESH_H
@@ -1,119 +1,967 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <future>
+#include <limits>
+#include <memory>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QStandardPaths>
+#include <QTemporaryFile>
 
 #include "loader.h"
+#include "meshcache.h"
 #include "vertex.h"
+#include "workspace.h"
+
+#ifdef Q_OS_UNIX
+#    include <sys/mman.h>
+#endif
+#ifdef Q_OS_LINUX
+#    include <poll.h>
+#    include <sys/inotify.h>
+#    include <unistd.h>
+#endif
 
-Loader::Loader(QObject* parent, const QString& filename, bool is_reload) : QThread(parent), filename(filename), is_reload(is_reload)
+Loader::Loader(QObject* parent, const QString& filename, bool is_reload, QuantizeMode quantize) :
+    QThread(parent),
+    filename(filename),
+    is_reload(is_reload),
+    quantize(quantize),
+    max_threads(0),
+    prefetch(false),
+    incremental(false)
 {
     // Nothing to do here
 }
 
 void Loader::run()
 {
-    Mesh* mesh = load_stl();
-    if (mesh) {
-        if (mesh->empty()) {
-            emit error_empty_mesh();
-            delete mesh;
-        } else {
-            emit got_mesh(mesh, is_reload);
+    profile.begin("open");
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit error_missing_file();
+        return;
+    }
+
+    // Reloads are triggered by FileWatcher, which only fires once a save
+    // has finished, but other files may still be in the middle of one.
+    if (!is_reload) {
+        wait_for_writer(file);
+    }
+
+    // Files too big to hold in memory are paged from disk instead, which
+    // is too much work to spend on a file that may never be opened
+    if (needs_paging(file)) {
+        if (!prefetch) {
+            load_paged(file);
+        }
+        return;
+    }
+
+    // The whole file is hashed in blocks, which keys the mesh cache by its
+    // contents.  Incremental reloads of a file that's been rewritten
+    // without any changes (or with a new header) stop here.
+    std::unique_ptr<FileSnapshot> snapshot(new FileSnapshot);
+    profile.begin("hash");
+    const bool hashed = hash_blocks(file, *snapshot);
+    profile.end(file.size(), snapshot->hashes.size());
+    if (!hashed) {
+        return;
+    } else if (incremental && is_reload && previous && previous->size == snapshot->size && previous->binary == snapshot->binary &&
+               previous->hashes == snapshot->hashes) {
+        profile.write_trace(filename);
+        emit loaded_file(filename);
+        return;
+    }
+
+    // Meshes that we've welded before come straight out of the cache.
+    // Only incremental loads keep their snapshot past this point.
+    const MeshCache cache(file, *snapshot);
+    if (!incremental) {
+        snapshot.reset();
+    }
+    profile.begin("cache");
+    if (Mesh* mesh = cache.load()) {
+        profile.end(file.size(), mesh->triCount());
+
+        // Preparing the mesh changes its layout, so the levels of detail
+        // are built from a copy, which is only made if there'll be any
+        std::unique_ptr<const Mesh> source;
+        if (wants_lods(mesh->triCount(), *mesh->stats())) {
+            source.reset(new Mesh(*mesh));
+        }
+        prepare_mesh(*mesh, profile, snapshot.get());
+        profile.write_trace(filename);
+        emit got_mesh(mesh, is_reload);
+        if (snapshot) {
+            emit got_snapshot(snapshot.release());
+        }
+        emit loaded_file(filename);
+        if (source) {
+            const GLuint* const indices = static_cast<const GLuint*>(source->indexBuffer());
+            build_lods(source->vertexData(), indices, source->indexBufferSize() / sizeof(GLuint), *source->stats());
+        }
+        return;
+    }
+
+    // Every stage checks isInterruptionRequested() between chunks of work,
+    // and bails out without emitting anything once a newer load has
+    // asked this one to stop.
+    profile.begin("decode");
+    QSharedPointer<Soup> soup_verts(new Soup);
+    Soup& verts = *soup_verts;
+    const bool okay = load_stl(file, verts);
+    profile.end(file.size(), verts.size() / 3);
+    if (!okay || isInterruptionRequested()) {
+        return;
+    } else if (verts.empty()) {
+        emit error_empty_mesh();
+        return;
+    }
+
+    // Both meshes carry the same statistics, so the GUI thread never has to
+    // scan either of them for bounds.
+    MeshStats stats;
+    if (!stats_from_verts(verts, stats)) {
+        return;
+    }
+
+    // If only some triangles have moved, and they still share vertices in
+    // the same way, their new positions are patched into the loaded mesh
+    // rather than welding and uploading the whole thing again.  The levels
+    // of detail are rebuilt from scratch, as they would be anyway.
+    if (snapshot && is_reload && previous) {
+        if (MeshPatch* patch = patch_from_verts(verts, *previous, *snapshot)) {
+            patch->stats = stats;
+            patch->serial = previous->serial;
+            snapshot->corner_slots = previous->corner_slots;
+            snapshot->slot_count = previous->slot_count;
+            snapshot->quantized = previous->quantized;
+            snapshot->lower = previous->lower;
+            snapshot->upper = previous->upper;
+            profile.write_trace(filename);
+            emit got_patch(patch);
+            emit got_snapshot(snapshot.release());
             emit loaded_file(filename);
+            build_lods(reinterpret_cast<const GLfloat*>(verts.data()), nullptr, verts.size(), stats);
+            return;
+        } else if (isInterruptionRequested()) {
+            return;
+        }
+    }
+
+    // Show the raw triangle soup as soon as it's decoded, then swap in the
+    // indexed mesh once it's ready.  The soup mesh shares verts rather than
+    // copying it, and the second mesh is sent as a reload so that it keeps
+    // whatever camera the first one set up.
+    if (!prefetch) {
+        Mesh* soup = new Mesh(soup_verts);
+        soup->setStats(stats);
+        emit got_mesh(soup, is_reload);
+    }
+
+    // The indexed mesh is handed over to the GUI thread (which frees it)
+    // before the cache entry is written, so that writing a big entry never
+    // holds up the display.  The copy that's stored shares the soup, and
+    // only duplicates the index arrays.
+    Mesh* mesh = mesh_from_verts(soup_verts);
+    if (mesh) {
+        mesh->setStats(stats);
+        std::unique_ptr<const Mesh> stored(cache.accepts(*mesh) ? new Mesh(*mesh) : nullptr);
+        prepare_mesh(*mesh, profile, snapshot.get());
+        profile.write_trace(filename);
+        emit got_mesh(mesh, true);
+        if (snapshot) {
+            emit got_snapshot(snapshot.release());
+        }
+        emit loaded_file(filename);
+
+        // The GUI thread may be reading the main profile by now
+        if (stored) {
+            LoadProfile store_profile;
+            store_profile.begin("store");
+            cache.store(*stored);
+            store_profile.end();
+            store_profile.write_trace(filename);
+            stored.reset();
         }
+
+        build_lods(reinterpret_cast<const GLfloat*>(verts.data()), nullptr, verts.size(), stats);
     }
 }
 
-////////////////////////////////////////////////////////////////////////////////
+bool Loader::cancelled() const
+{
+    return isInterruptionRequested();
+}
+
+const LoadProfile& Loader::load_profile() const
+{
+    return profile;
+}
 
-void parallel_sort(Vertex* begin, Vertex* end, int threads)
+void Loader::prepare_mesh(Mesh& mesh, LoadProfile& prof, FileSnapshot* snapshot)
 {
-    if (threads < 2 || end - begin < 2) {
-        std::sort(begin, end);
+    prof.begin("chunk");
+    if (snapshot && snapshot->binary && mesh.indexed()) {
+        std::vector<GLuint>* const slots = new std::vector<GLuint>;
+        snapshot->corner_slots.reset(slots);
+        mesh.chunk(slots);
     } else {
-        const auto mid = begin + (end - begin) / 2;
-        if (threads == 2) {
-            auto future = std::async(parallel_sort, begin, mid, threads / 2);
-            std::sort(mid, end);
-            future.wait();
-        } else {
-            auto a = std::async(std::launch::async, parallel_sort, begin, mid, threads / 2);
-            auto b = std::async(std::launch::async, parallel_sort, mid, end, threads / 2);
-            a.wait();
-            b.wait();
+        mesh.chunk();
+    }
+    prof.end(mesh.indexBufferSize(), mesh.chunks().size());
+
+    if (quantize == quantize_always || (quantize == quantize_auto && mesh.triCount() >= QUANTIZE_TRIANGLES)) {
+        prof.begin("quantize");
+        mesh.quantize();
+        prof.end(mesh.vertexBufferSize(), mesh.vertexCount());
+    }
+
+    if (snapshot) {
+        snapshot->slot_count = mesh.vertexCount();
+        snapshot->quantized = mesh.quantized();
+        if (const MeshStats* stats = mesh.stats()) {
+            snapshot->lower = stats->lower;
+            snapshot->upper = stats->upper;
         }
-        std::inplace_merge(begin, mid, end);
     }
 }
 
-Mesh* mesh_from_verts(uint32_t tri_count, QVector<Vertex>& verts)
+bool Loader::wants_lods(size_t tri_count, const MeshStats& stats)
+{
+    return tri_count >= LOD_TRIANGLES && stats.area > 0;
+}
+
+void Loader::build_lods(const GLfloat* xyz, const GLuint* indices, size_t corners, const MeshStats& stats)
 {
-    // Save indicies as the second element in the array
-    // (so that we can reconstruct triangle order after sorting)
-    for (size_t i = 0; i < tri_count * 3; ++i) {
-        verts[i].i = i;
+    const size_t tri_count = corners / 3;
+    if (!wants_lods(tri_count, stats)) {
+        return;
     }
 
+    // The GUI thread may already be reading the main profile, so these
+    // stages are recorded separately (and only end up in the trace).
+    LoadProfile lod_profile;
+
+    // Each level is decimated from the one before, so that the whole chain
+    // costs little more than the first level.  Levels are handed over once
+    // the next one has been built from them, since preparing them for
+    // drawing changes their layout.
+    Mesh* current = nullptr;
+    for (int level = 1; level <= LOD_LEVELS + 1; ++level) {
+        Mesh* next = nullptr;
+        if (level <= LOD_LEVELS) {
+            // Clustering leaves about two triangles per occupied cell, and
+            // a surface of area A occupies about A / size^2 cells.
+            const double target = tri_count / pow(4.0, level);
+            const float cell_size = sqrt(2 * stats.area / target);
+
+            lod_profile.begin("lod");
+            next = current ? decimate(current->vertexData(), static_cast<const GLuint*>(current->indexBuffer()),
+                                      current->indexBufferSize() / sizeof(GLuint), stats, cell_size)
+                           : decimate(xyz, indices, corners, stats, cell_size);
+            lod_profile.end(0, next ? next->triCount() : 0);
+            if (cancelled()) {
+                delete current;
+                delete next;
+                return;
+            }
+
+            // Stop once a level doesn't save much over the one before
+            const int previous = current ? current->triCount() : tri_count;
+            if (next && (next->empty() || next->triCount() > previous * 3 / 4)) {
+                delete next;
+                next = nullptr;
+            }
+        }
+        if (current) {
+            prepare_mesh(*current, lod_profile);
+            emit got_lod(current, level - 1);
+        }
+        if (!next) {
+            break;
+        }
+        current = next;
+    }
+    lod_profile.write_trace(filename);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+unsigned thread_count()
+{
     // Check how many threads the hardware can safely support. This may return
     // 0 if the property can't be read so we shoud check for that too.
     auto threads = std::thread::hardware_concurrency();
     if (threads == 0) {
         threads = 8;
     }
+    return threads;
+}
+
+/*  Splits [0, count) into blocks of block_size items, and calls
+ *  f(begin, end, block) for every block on a pool of threads.  Blocks are
+ *  numbered in order, so per-block results can be combined
+ *  deterministically afterwards.
+ *
+ *  Between blocks, loader->cancelled() is checked; if it returns true,
+ *  the remaining blocks are skipped and this returns false. */
+template <typename F>
+bool parallel_for(const Loader* loader, size_t count, size_t block_size, F f)
+{
+    const size_t blocks = (count + block_size - 1) / block_size;
+    const unsigned threads = std::min<size_t>(loader->worker_threads(), std::max<size_t>(blocks, 1));
+
+    std::atomic<size_t> next_block(0);
+    std::atomic<bool> stopped(false);
+    auto worker = [&]() {
+        size_t block;
+        while (!stopped && (block = next_block++) < blocks) {
+            if (loader->cancelled()) {
+                stopped = true;
+            } else {
+                f(block * block_size, std::min(count, (block + 1) * block_size), block);
+            }
+        }
+    };
+
+    std::vector<std::future<void>> futures;
+    for (unsigned t = 1; t < threads; ++t) {
+        futures.push_back(std::async(std::launch::async, worker));
+    }
+    worker();
+    for (auto& future : futures) {
+        future.wait();
+    }
+    return !stopped;
+}
+
+/*  Returns the bit pattern of a coordinate, with -0.0 folded into 0.0
+ *  so that the two still weld together (as they compare equal). */
+inline uint32_t coord_bits(float f)
+{
+    if (f == 0.0f) {
+        f = 0.0f;
+    }
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+/*  Vertices are welded when their coordinates are bitwise identical.
+ *  Unlike a numeric comparison, this is well-behaved for NaNs. */
+inline bool same_position(const Vertex& a, const Vertex& b)
+{
+    return coord_bits(a.x) == coord_bits(b.x) && coord_bits(a.y) == coord_bits(b.y) && coord_bits(a.z) == coord_bits(b.z);
+}
+
+inline uint64_t position_hash(const Vertex& v)
+{
+    uint64_t h = coord_bits(v.x) * 0x9E3779B97F4A7C15ull;
+    h ^= coord_bits(v.y) * 0xC2B2AE3D27D4EB4Full;
+    h ^= coord_bits(v.z) * 0x165667B19E3779F9ull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return h;
+}
+/*  Running totals for MeshStats over a range of triangles.  Sums are kept
+ *  in double precision, since big meshes add up millions of tiny terms. */
+struct StatsTotals {
+    StatsTotals() :
+        lower{INFINITY, INFINITY, INFINITY},
+        upper{-INFINITY, -INFINITY, -INFINITY},
+        area(0),
+        volume(0),
+        moment{0, 0, 0},
+        edge_min(INFINITY),
+        edge_max(0),
+        edge_sum(0),
+        edge_squares(0),
+        edge_count(0)
+    {
+        // Nothing to do here
+    }
+
+    void add(const Vertex& a, const Vertex& b, const Vertex& c)
+    {
+        for (const Vertex* v : {&a, &b, &c}) {
+            lower[0] = fmin(lower[0], v->x);
+            lower[1] = fmin(lower[1], v->y);
+            lower[2] = fmin(lower[2], v->z);
+            upper[0] = fmax(upper[0], v->x);
+            upper[1] = fmax(upper[1], v->y);
+            upper[2] = fmax(upper[2], v->z);
+        }
+
+        // Twice the triangle's area is the length of the cross product of
+        // two of its edges, and the signed volume of the tetrahedron it
+        // makes with the origin is a scalar triple product.
+        const float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+        const float vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+        const float wx = c.x - b.x, wy = c.y - b.y, wz = c.z - b.z;
+        const float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        const double tri_area = 0.5 * sqrt(double(nx) * nx + double(ny) * ny + double(nz) * nz);
+        area += tri_area;
+        volume += (double(a.x) * (double(b.y) * c.z - double(b.z) * c.y) + double(a.y) * (double(b.z) * c.x - double(b.x) * c.z) +
+                   double(a.z) * (double(b.x) * c.y - double(b.y) * c.x)) /
+                  6;
+        moment[0] += tri_area * (double(a.x) + b.x + c.x) / 3;
+        moment[1] += tri_area * (double(a.y) + b.y + c.y) / 3;
+        moment[2] += tri_area * (double(a.z) + b.z + c.z) / 3;
+
+        const float edges[3] = {sqrtf(ux * ux + uy * uy + uz * uz), sqrtf(vx * vx + vy * vy + vz * vz), sqrtf(wx * wx + wy * wy + wz * wz)};
+        for (const float e : edges) {
+            edge_min = fmin(edge_min, e);
+            edge_max = fmax(edge_max, e);
+            edge_sum += e;
+            edge_squares += double(e) * e;
+        }
+        edge_count += 3;
+    }
+
+    void merge(const StatsTotals& other)
+    {
+        for (int axis = 0; axis < 3; ++axis) {
+            lower[axis] = fmin(lower[axis], other.lower[axis]);
+            upper[axis] = fmax(upper[axis], other.upper[axis]);
+            moment[axis] += other.moment[axis];
+        }
+        area += other.area;
+        volume += other.volume;
+        edge_min = fmin(edge_min, other.edge_min);
+        edge_max = fmax(edge_max, other.edge_max);
+        edge_sum += other.edge_sum;
+        edge_squares += other.edge_squares;
+        edge_count += other.edge_count;
+    }
+
+    /*  Fills in the statistics from the totals over every triangle */
+    void finish(MeshStats& stats) const
+    {
+        stats.lower = QVector3D(lower[0], lower[1], lower[2]);
+        stats.upper = QVector3D(upper[0], upper[1], upper[2]);
+        stats.area = area;
+        stats.volume = volume;
+        if (area > 0) {
+            stats.centroid = QVector3D(moment[0] / area, moment[1] / area, moment[2] / area);
+        } else {
+            stats.centroid = (stats.lower + stats.upper) / 2;
+        }
+        stats.edge_min = edge_count ? edge_min : 0;
+        stats.edge_max = edge_max;
+        stats.edge_mean = edge_count ? edge_sum / edge_count : 0;
+        if (edge_count) {
+            stats.edge_stddev = sqrt(std::max(0.0, edge_squares / edge_count - stats.edge_mean * stats.edge_mean));
+        } else {
+            stats.edge_stddev = 0;
+        }
+    }
 
-    // Sort the set of vertices (to deduplicate)
-    parallel_sort(verts.begin(), verts.end(), threads);
+    float lower[3], upper[3];
+    double area, volume;
+    double moment[3];
+    float edge_min, edge_max;
+    double edge_sum, edge_squares;
+    size_t edge_count;
+};
+} // namespace
+
+void Loader::set_worker_threads(unsigned n)
+{
+    max_threads = n;
+}
+
+unsigned Loader::worker_threads() const
+{
+    return max_threads ? max_threads : thread_count();
+}
+
+void Loader::set_prefetch(bool p)
+{
+    prefetch = p;
+}
 
-    // This vector will store triangles as sets of 3 indices
-    std::vector<GLuint> indices(tri_count * 3);
+void Loader::set_incremental(bool i, const QSharedPointer<const FileSnapshot>& p)
+{
+    incremental = i;
+    previous = p;
+}
+
+bool Loader::stats_from_verts(const Soup& verts, MeshStats& stats)
+{
+    const size_t tri_count = verts.size() / 3;
+    const size_t BLOCK = 1 << 16;
+    profile.begin("stats");
+
+    // Blocks are merged in order, so the floating-point sums come out the
+    // same no matter how many threads did the work.
+    std::vector<StatsTotals> block_totals((tri_count + BLOCK - 1) / BLOCK);
+    const bool okay = parallel_for(this, tri_count, BLOCK, [&](size_t begin, size_t end, size_t block) {
+        StatsTotals& totals = block_totals[block];
+        for (size_t t = begin; t < end; ++t) {
+            totals.add(verts[3 * t], verts[3 * t + 1], verts[3 * t + 2]);
+        }
+    });
+    profile.end(verts.size() * sizeof(Vertex), tri_count);
+    if (!okay) {
+        return false;
+    }
+
+    StatsTotals totals;
+    for (const auto& b : block_totals) {
+        totals.merge(b);
+    }
+    totals.finish(stats);
+    return true;
+}
+
+Mesh* Loader::mesh_from_verts(const SharedSoup& soup)
+{
+    const Soup& verts = *soup;
+    const size_t vertex_total = verts.size();
+    const size_t BLOCK = 1 << 16;
+    profile.begin("dedup");
 
-    // Go through the sorted vertex list, deduplicating and creating
-    // an indexed geometry representation for the triangles.
-    // Unique vertices are moved so that they occupy the first vertex_count
-    // positions in the verts array.
+    // Open-addressing hash table, sized to stay at most 2/3 full even if
+    // every vertex is unique.  Each slot holds (index + 1) of the first
+    // vertex with a given position, or zero if the slot is empty.
+    size_t capacity = 1;
+    while (capacity < vertex_total + vertex_total / 2) {
+        capacity <<= 1;
+    }
+    const size_t mask = capacity - 1;
+
+    // Slots are tagged with the FIRST bit below, so they have to fit in
+    // the bits under it (which also keeps every index + 1 within a GLuint).
+    // Meshes too big for that are left as plain triangle soups.
+    const GLuint FIRST = 1u << 31;
+    if (capacity > FIRST) {
+        profile.end();
+        return new Mesh(soup);
+    }
+
+    // The table is the biggest scratch array in the whole load, so it's
+    // borrowed from the workspace (and only needs clearing if it's been
+    // used before).
+    static_assert(sizeof(std::atomic<GLuint>) == sizeof(GLuint), "Atomic indices must be plain words");
+    Workspace::Buffer table_memory = Workspace::acquire(capacity * sizeof(GLuint));
+    std::atomic<GLuint>* const table = table_memory.as<std::atomic<GLuint>>();
+    if (!table_memory.fresh() && !parallel_for(this, capacity, BLOCK, [&](size_t begin, size_t end, size_t) {
+            memset(static_cast<void*>(table + begin), 0, (end - begin) * sizeof(GLuint));
+        })) {
+        return nullptr;
+    }
+
+    // Insert every vertex into the table in parallel.  Threads race to claim
+    // empty slots, then lower the stored index with compare-and-swap, so the
+    // table ends up holding the first occurrence of every position no matter
+    // how the work was scheduled.
+    bool okay = parallel_for(this, vertex_total, BLOCK, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i) {
+            const GLuint id = i + 1;
+            size_t slot = position_hash(verts[i]) & mask;
+            GLuint cur = table[slot].load(std::memory_order_relaxed);
+            while (true) {
+                if (cur == 0) {
+                    if (table[slot].compare_exchange_strong(cur, id, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (same_position(verts[cur - 1], verts[i])) {
+                    while (id < cur && !table[slot].compare_exchange_weak(cur, id, std::memory_order_relaxed)) {
+                        // Retry with the freshly loaded value of cur
+                    }
+                    break;
+                } else {
+                    slot = (slot + 1) & mask;
+                    cur = table[slot].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    });
+
+    // This vector will store triangles as sets of 3 indices.  It temporarily
+    // holds each vertex's table slot, with the high bit set on the vertices
+    // that are the first occurrence of their position.
+    std::vector<GLuint> indices(vertex_total);
+    std::vector<size_t> block_unique((vertex_total + BLOCK - 1) / BLOCK);
+    okay = okay && parallel_for(this, vertex_total, BLOCK, [&](size_t begin, size_t end, size_t block) {
+        size_t unique = 0;
+        for (size_t i = begin; i < end; ++i) {
+            size_t slot = position_hash(verts[i]) & mask;
+            GLuint cur = table[slot].load(std::memory_order_relaxed);
+            while (!same_position(verts[cur - 1], verts[i])) {
+                slot = (slot + 1) & mask;
+                cur = table[slot].load(std::memory_order_relaxed);
+            }
+            if (cur == i + 1) {
+                indices[i] = slot | FIRST;
+                unique++;
+            } else {
+                indices[i] = slot;
+            }
+        }
+        block_unique[block] = unique;
+    });
+    profile.end(vertex_total * sizeof(Vertex), vertex_total);
+    if (!okay) {
+        return nullptr;
+    }
+
+    // Number unique vertices in order of first occurrence, noting where
+    // each one is in the soup and storing its final index in the table.
+    // The positions themselves stay in the soup until Mesh::chunk gathers
+    // them into their final layout, so they're never copied twice.
+    std::vector<size_t> block_offset(block_unique.size());
     size_t vertex_count = 0;
-    for (auto v : verts) {
-        if (!vertex_count || v != verts[vertex_count - 1]) {
-            verts[vertex_count++] = v;
+    for (size_t b = 0; b < block_unique.size(); ++b) {
+        block_offset[b] = vertex_count;
+        vertex_count += block_unique[b];
+    }
+    profile.begin("flatten");
+    std::vector<GLuint> first(vertex_count);
+    okay = parallel_for(this, vertex_total, BLOCK, [&](size_t begin, size_t end, size_t block) {
+        GLuint next = block_offset[block];
+        for (size_t i = begin; i < end; ++i) {
+            if (indices[i] & FIRST) {
+                first[next] = i;
+                table[indices[i] & ~FIRST].store(next++, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    // Finally, resolve every vertex's slot into its final index
+    okay = okay && parallel_for(this, vertex_total, BLOCK, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i) {
+            indices[i] = table[indices[i] & ~FIRST].load(std::memory_order_relaxed);
+        }
+    });
+    profile.end(first.size() * sizeof(GLuint) + indices.size() * sizeof(GLuint), vertex_count);
+    if (!okay) {
+        return nullptr;
+    }
+
+    return new Mesh(soup, std::move(first), std::move(indices));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+/*  Sum of the plane quadrics of the triangles touching a grid cell, along
+ *  with the plain sum of the corners in it as a fallback position.  The
+ *  quadric is stored as the symmetric matrix A (xx, xy, xz, yy, yz, zz)
+ *  and vector b, whose minimizer solves A x = -b. */
+struct Cluster {
+    Cluster() : a{0, 0, 0, 0, 0, 0}, b{0, 0, 0}, sum{0, 0, 0}, count(0)
+    {
+        // Nothing to do here
+    }
+
+    double a[6];
+    double b[3];
+    double sum[3];
+    GLuint count;
+};
+
+/*  Solves for the point with the least quadric error in a cluster,
+ *  falling back to the mean of its corners when the quadric is
+ *  ill-conditioned (e.g. on a flat patch) or its minimizer wanders
+ *  further than a cell away. */
+void cluster_position(const Cluster& c, float cell_size, GLfloat* out)
+{
+    double mean[3];
+    for (int i = 0; i < 3; ++i) {
+        mean[i] = c.sum[i] / c.count;
+    }
+
+    const double xx = c.a[0], xy = c.a[1], xz = c.a[2], yy = c.a[3], yz = c.a[4], zz = c.a[5];
+    const double c00 = yy * zz - yz * yz, c01 = xz * yz - xy * zz, c02 = xy * yz - xz * yy;
+    const double det = xx * c00 + xy * c01 + xz * c02;
+    const double trace = (xx + yy + zz) / 3;
+    if (std::fabs(det) > 1e-6 * trace * trace * trace) {
+        const double c11 = xx * zz - xz * xz, c12 = xy * xz - xx * yz, c22 = xx * yy - xy * xy;
+        const double x = -(c00 * c.b[0] + c01 * c.b[1] + c02 * c.b[2]) / det;
+        const double y = -(c01 * c.b[0] + c11 * c.b[1] + c12 * c.b[2]) / det;
+        const double z = -(c02 * c.b[0] + c12 * c.b[1] + c22 * c.b[2]) / det;
+        if (std::fabs(x - mean[0]) < cell_size && std::fabs(y - mean[1]) < cell_size && std::fabs(z - mean[2]) < cell_size) {
+            mean[0] = x;
+            mean[1] = y;
+            mean[2] = z;
         }
-        indices[v.i] = vertex_count - 1;
     }
-    verts.resize(vertex_count);
+    for (int i = 0; i < 3; ++i) {
+        out[i] = mean[i];
+    }
+}
+
+inline uint64_t mix_hash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+} // namespace
 
+Mesh* Loader::decimate(const GLfloat* xyz, const GLuint* indices, size_t corners, const MeshStats& stats, float cell_size)
+{
+    // Cells are numbered with 21 bits per axis, so very fine grids are
+    // coarsened to fit.
+    const QVector3D extent = stats.upper - stats.lower;
+    const float max_extent = std::max(extent.x(), std::max(extent.y(), extent.z()));
+    cell_size = std::max(cell_size, max_extent / (1 << 20));
+    const float inverse = 1 / cell_size;
+    auto cell_key = [&](const GLfloat* p) {
+        uint64_t key = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float f = (p[axis] - stats.lower[axis]) * inverse;
+            key = (key << 21) | (f > 0 ? std::min<uint64_t>(f, (1 << 21) - 1) : 0);
+        }
+        return key;
+    };
+
+    // Open-addressing table from cell keys (plus one, so that zero marks an
+    // empty slot) to cluster indices, kept at most half full.
+    std::vector<Cluster> clusters;
+    std::vector<uint64_t> cell_keys(1 << 16);
+    std::vector<GLuint> cell_clusters(1 << 16);
+    auto cluster_of = [&](const GLfloat* p) {
+        const uint64_t key = cell_key(p) + 1;
+        size_t mask = cell_keys.size() - 1;
+        size_t slot = mix_hash(key) & mask;
+        while (cell_keys[slot] && cell_keys[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        if (cell_keys[slot]) {
+            return cell_clusters[slot];
+        }
+
+        const GLuint id = clusters.size();
+        cell_keys[slot] = key;
+        cell_clusters[slot] = id;
+        clusters.push_back(Cluster());
+        if (clusters.size() * 2 > cell_keys.size()) {
+            std::vector<uint64_t> old_keys(cell_keys.size() * 2);
+            std::vector<GLuint> old_clusters(cell_clusters.size() * 2);
+            old_keys.swap(cell_keys);
+            old_clusters.swap(cell_clusters);
+            mask = cell_keys.size() - 1;
+            for (size_t i = 0; i < old_keys.size(); ++i) {
+                if (old_keys[i]) {
+                    size_t s = mix_hash(old_keys[i]) & mask;
+                    while (cell_keys[s]) {
+                        s = (s + 1) & mask;
+                    }
+                    cell_keys[s] = old_keys[i];
+                    cell_clusters[s] = old_clusters[i];
+                }
+            }
+        }
+        return id;
+    };
+
+    // Triangles that survive clustering, rotated so that their smallest
+    // cluster comes first (which keeps their winding), along with a set
+    // of them to drop duplicates.  Set slots hold (index + 1), or zero.
+    std::vector<GLuint> tris;
+    std::vector<GLuint> tri_set(1 << 16);
+    auto add_triangle = [&](GLuint a, GLuint b, GLuint c) {
+        if (b < a && b < c) {
+            std::swap(a, b);
+            std::swap(b, c);
+        } else if (c < a && c < b) {
+            std::swap(a, c);
+            std::swap(b, c);
+        }
+        size_t mask = tri_set.size() - 1;
+        size_t slot = mix_hash((uint64_t(a) << 32 | b) ^ mix_hash(c)) & mask;
+        while (const GLuint t = tri_set[slot]) {
+            if (tris[(t - 1) * 3] == a && tris[(t - 1) * 3 + 1] == b && tris[(t - 1) * 3 + 2] == c) {
+                return;
+            }
+            slot = (slot + 1) & mask;
+        }
+        tris.insert(tris.end(), {a, b, c});
+        tri_set[slot] = tris.size() / 3;
+        if (tris.size() / 3 * 2 > tri_set.size()) {
+            std::vector<GLuint>(tri_set.size() * 2).swap(tri_set);
+            mask = tri_set.size() - 1;
+            for (GLuint t = 0; t < tris.size() / 3; ++t) {
+                size_t s = mix_hash((uint64_t(tris[t * 3]) << 32 | tris[t * 3 + 1]) ^ mix_hash(tris[t * 3 + 2])) & mask;
+                while (tri_set[s]) {
+                    s = (s + 1) & mask;
+                }
+                tri_set[s] = t + 1;
+            }
+        }
+    };
+
+    // Accumulate every triangle's plane, weighted by its area, into the
+    // clusters of its corners.
+    for (size_t t = 0; t < corners; t += 3) {
+        if (t % (3 << 16) == 0 && cancelled()) {
+            return nullptr;
+        }
+
+        const GLfloat* p[3];
+        GLuint c[3];
+        for (int k = 0; k < 3; ++k) {
+            p[k] = xyz + 3 * size_t(indices ? indices[t + k] : t + k);
+            c[k] = cluster_of(p[k]);
+        }
+
+        const double ux = p[1][0] - p[0][0], uy = p[1][1] - p[0][1], uz = p[1][2] - p[0][2];
+        const double vx = p[2][0] - p[0][0], vy = p[2][1] - p[0][1], vz = p[2][2] - p[0][2];
+        double nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        const double length = sqrt(nx * nx + ny * ny + nz * nz);
+        const double weight = length / 2;
+        if (length > 0) {
+            nx /= length;
+            ny /= length;
+            nz /= length;
+        }
+        const double d = -(nx * p[0][0] + ny * p[0][1] + nz * p[0][2]);
+        for (int k = 0; k < 3; ++k) {
+            Cluster& cluster = clusters[c[k]];
+            cluster.a[0] += weight * nx * nx;
+            cluster.a[1] += weight * nx * ny;
+            cluster.a[2] += weight * nx * nz;
+            cluster.a[3] += weight * ny * ny;
+            cluster.a[4] += weight * ny * nz;
+            cluster.a[5] += weight * nz * nz;
+            cluster.b[0] += weight * d * nx;
+            cluster.b[1] += weight * d * ny;
+            cluster.b[2] += weight * d * nz;
+            for (int i = 0; i < 3; ++i) {
+                cluster.sum[i] += p[k][i];
+            }
+            cluster.count++;
+        }
+
+        if (c[0] != c[1] && c[1] != c[2] && c[0] != c[2]) {
+            add_triangle(c[0], c[1], c[2]);
+        }
+    }
+
+    // Number the clusters that are still used by a triangle in order of
+    // first use, and place each one at its best position.
+    std::vector<GLuint> remap(clusters.size(), std::numeric_limits<GLuint>::max());
     std::vector<GLfloat> flat_verts;
-    flat_verts.reserve(vertex_count * 3);
-    for (auto v : verts) {
-        flat_verts.push_back(v.x);
-        flat_verts.push_back(v.y);
-        flat_verts.push_back(v.z);
+    for (auto& v : tris) {
+        if (remap[v] == std::numeric_limits<GLuint>::max()) {
+            remap[v] = flat_verts.size() / 3;
+            flat_verts.resize(flat_verts.size() + 3);
+            GLfloat* out = &flat_verts[flat_verts.size() - 3];
+            cluster_position(clusters[v], cell_size, out);
+            for (int axis = 0; axis < 3; ++axis) {
+                out[axis] = std::min(std::max(out[axis], stats.lower[axis]), stats.upper[axis]);
+            }
+        }
+        v = remap[v];
     }
 
-    return new Mesh(std::move(flat_verts), std::move(indices));
+    Mesh* mesh = new Mesh(std::move(flat_verts), std::move(tris));
+    mesh->setStats(stats);
+    return mesh;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Mesh* Loader::load_stl()
+namespace
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly)) {
-        emit error_missing_file();
-        return NULL;
+/*  Maps the whole file into memory, advising the kernel that we'll walk
+ *  it front to back.  Files that can't be mapped (e.g. compressed Qt
+ *  resources) are instead read into fallback in one go. */
+const uchar* map_file(QFile& file, QByteArray& fallback)
+{
+    const uchar* data = file.map(0, file.size());
+    if (data) {
+#ifdef Q_OS_UNIX
+        madvise(const_cast<uchar*>(data), file.size(), MADV_SEQUENTIAL);
+#endif
+    } else {
+        file.seek(0);
+        fallback = file.readAll();
+        data = reinterpret_cast<const uchar*>(fallback.constData());
     }
+    return data;
+}
+
+} // namespace
 
-    qint64 file_size, file_size_old;
-    file_size = file.size();
+void Loader::wait_for_writer(const QFile& file)
+{
+    // Files that haven't been modified recently are assumed to be complete
+    const QFileInfo info(file);
+    if (info.lastModified().msecsTo(QDateTime::currentDateTime()) > SETTLE_MS) {
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    // Watch the file for a short quiet period, and if nothing touches it,
+    // take it as complete straight away.  Otherwise somebody is still
+    // writing it, so wait for them to close it, giving up once it has gone
+    // SETTLE_MS without being modified (or if we're cancelled).
+    const int fd = inotify_init1(IN_CLOEXEC);
+    if (fd >= 0) {
+        const QByteArray path = QFile::encodeName(info.absoluteFilePath());
+        if (inotify_add_watch(fd, path.constData(), IN_MODIFY | IN_CLOSE_WRITE) >= 0) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            const int QUIET_MS = 20;
+            const int SLICE_MS = 50;
+            int quiet_ms = 0;
+            bool done = poll(&pfd, 1, QUIET_MS) <= 0;
+            while (!done && quiet_ms < SETTLE_MS && !cancelled()) {
+                if (poll(&pfd, 1, SLICE_MS) <= 0) {
+                    quiet_ms += SLICE_MS;
+                    continue;
+                }
+                quiet_ms = 0;
+                alignas(struct inotify_event) char buf[4096];
+                const ssize_t len = read(fd, buf, sizeof(buf));
+                if (len <= 0) {
+                    break;
+                }
+                for (char* p = buf; p < buf + len;) {
+                    const auto event = reinterpret_cast<const struct inotify_event*>(p);
+                    done |= (event->mask & IN_CLOSE_WRITE) != 0;
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+            close(fd);
+            return;
+        }
+        close(fd);
+    }
+#endif
+
+    // The file can't be watched, so it only has to stay the same for a
+    // moment
+    QFileInfo now(info);
+    QFileInfo before;
     do {
-        file_size_old = file_size;
+        before = now;
         QThread::usleep(100000);
-        file_size = file.size();
-    } while (file_size != file_size_old);
+        now.refresh();
+    } while ((now.size() != before.size() || now.lastModified() != before.lastModified()) && !cancelled());
+}
 
+bool Loader::load_stl(QFile& file, Soup& verts)
+{
     // First, try to read the stl as an ASCII file
     if (file.read(5) == "solid") {
         file.readLine(); // skip solid name
         const auto line = file.readLine().trimmed();
         if (line.startsWith("facet") || line.startsWith("endsolid")) {
             file.seek(0);
-            return read_stl_ascii(file);
+            return read_stl_ascii(file, verts);
         }
         // Otherwise, this STL is a binary stl but contains 'solid' as
         // the first five characters.  This is a bad life choice, but
@@ -122,87 +970,762 @@ Mesh* Loader::load_stl()
     }
 
     file.seek(0);
-    return read_stl_binary(file);
+    return read_stl_binary(file, verts);
 }
 
-Mesh* Loader::read_stl_binary(QFile& file)
+bool Loader::read_stl_binary(QFile& file, Soup& verts)
 {
-    QDataStream data(&file);
-    data.setByteOrder(QDataStream::LittleEndian);
-    data.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    const qint64 file_size = file.size();
+    if (file_size < 84) {
+        emit error_bad_stl();
+        return false;
+    }
+
+    // Decode triangles straight out of the page cache, rather than
+    // staging them in an intermediate heap buffer.
+    QByteArray fallback;
+    const uchar* data = map_file(file, fallback);
 
     // Load the triangle count from the .stl file
-    file.seek(80);
-    uint32_t tri_count;
-    data >> tri_count;
+    const uint32_t tri_count = qFromLittleEndian<quint32>(data + 80);
 
     // Verify that the file is the right size
-    if (file.size() != 84 + tri_count * 50) {
+    if (file_size != 84 + qint64(tri_count) * 50) {
         emit error_bad_stl();
-        return NULL;
+        return false;
     }
 
-    // Extract vertices into an array of xyz, unsigned pairs
-    QVector<Vertex> verts(tri_count * 3);
-
-    // Dummy array, because readRawData is faster than skipRawData
-    std::unique_ptr<uint8_t[]> buffer(new uint8_t[tri_count * 50]);
-    data.readRawData((char*)buffer.get(), tri_count * 50);
+    // Extract vertices into an array of xyz triples
+    verts.resize(size_t(tri_count) * 3);
 
     // Store vertices in the array, processing one triangle at a time.
-    auto b = buffer.get() + 3 * sizeof(float);
-    for (auto v = verts.begin(); v != verts.end(); v += 3) {
-        // Load vertex data from .stl file into vertices
+    Vertex* const out = verts.data();
+    const bool okay = parallel_for(this, tri_count, 1 << 16, [&](size_t begin, size_t end, size_t) {
+        auto b = data + 84 + begin * 50 + 3 * sizeof(float);
+        for (auto v = out + begin * 3; v != out + end * 3; v += 3) {
+            // Load vertex data from .stl file into vertices
+            for (unsigned i = 0; i < 3; ++i) {
+                qFromLittleEndian<float>(b, 3, &v[i]);
+                b += 3 * sizeof(float);
+            }
+
+            // Skip face attribute and next face's normal vector
+            b += 3 * sizeof(float) + sizeof(uint16_t);
+        }
+    });
+
+    if (fallback.isEmpty()) {
+        file.unmap(const_cast<uchar*>(data));
+    }
+
+    return okay;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+/*  Hashes a block of the file eight bytes at a time, which is quick
+ *  enough to keep up with reading it from the page cache */
+uint64_t block_hash(const uchar* data, size_t size)
+{
+    uint64_t h = size * 0x9E3779B97F4A7C15ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h = (h ^ mix_hash(word)) * 0xBF58476D1CE4E5B9ull;
+    }
+    for (; i < size; ++i) {
+        h = (h ^ data[i]) * 0x100000001B3ull;
+    }
+    return mix_hash(h);
+}
+} // namespace
+
+bool Loader::hash_blocks(QFile& file, FileSnapshot& snapshot)
+{
+    QByteArray fallback;
+    const uchar* const data = map_file(file, fallback);
+    snapshot.size = file.size();
+    snapshot.binary = snapshot.size >= 84 && snapshot.size == 84 + qint64(qFromLittleEndian<quint32>(data + 80)) * 50;
+
+    // A binary file's header is left out, since exporters often stamp
+    // it with the time of the export
+    const qint64 start = snapshot.binary ? 84 : 0;
+    const qint64 block_bytes = FileSnapshot::BLOCK_TRIANGLES * 50;
+    snapshot.hashes.resize((snapshot.size - start + block_bytes - 1) / block_bytes);
+    quint64* const hashes = snapshot.hashes.data();
+    const bool okay = parallel_for(this, snapshot.hashes.size(), 16, [&](size_t begin, size_t end, size_t) {
+        for (size_t b = begin; b < end; ++b) {
+            const qint64 offset = start + b * block_bytes;
+            hashes[b] = block_hash(data + offset, std::min(block_bytes, snapshot.size - offset));
+        }
+    });
+
+    if (fallback.isEmpty()) {
+        file.unmap(const_cast<uchar*>(data));
+    }
+    return okay;
+}
+
+MeshPatch* Loader::patch_from_verts(const Soup& verts, const FileSnapshot& before, const FileSnapshot& after)
+{
+    // Only binary files with the same number of triangles can be patched
+    if (!before.corner_slots || !before.binary || !after.binary || before.size != after.size ||
+        before.corner_slots->size() != size_t(verts.size())) {
+        return nullptr;
+    }
+    const std::vector<GLuint>& slots = *before.corner_slots;
+    const size_t block_corners = FileSnapshot::BLOCK_TRIANGLES * 3;
+    const size_t corner_count = slots.size();
+
+    std::vector<size_t> changed;
+    for (int b = 0; b < after.hashes.size(); ++b) {
+        if (after.hashes[b] != before.hashes[b]) {
+            changed.push_back(b);
+        }
+    }
+    if (changed.size() * block_corners > corner_count / PATCH_FRACTION) {
+        return nullptr;
+    }
+
+    // Find the new position of every vertex that a changed corner uses.
+    // Corners that shared a vertex before must all have moved to the same
+    // place, and a quantized vertex buffer can't hold positions outside
+    // the bounds it was made with.
+    profile.begin("patch");
+    QHash<GLuint, GLuint> moved;
+    for (const size_t b : changed) {
+        for (size_t c = b * block_corners; c < std::min(corner_count, (b + 1) * block_corners); ++c) {
+            const Vertex& v = verts[c];
+            const auto found = moved.constFind(slots[c]);
+            if (found != moved.constEnd()) {
+                if (!same_position(verts[*found], v)) {
+                    return nullptr;
+                }
+            } else if (before.quantized && (v.x < before.lower.x() || v.x > before.upper.x() || v.y < before.lower.y() ||
+                                            v.y > before.upper.y() || v.z < before.lower.z() || v.z > before.upper.z())) {
+                return nullptr;
+            } else {
+                moved.insert(slots[c], c);
+            }
+        }
+    }
+
+    // Corners in the unchanged blocks keep their positions, so any vertex
+    // that they share with a changed corner must have stayed put
+    std::vector<quint64> touched((before.slot_count + 63) / 64);
+    for (auto m = moved.constBegin(); m != moved.constEnd(); ++m) {
+        touched[m.key() / 64] |= quint64(1) << (m.key() % 64);
+    }
+    std::atomic<bool> stable(true);
+    const bool okay = parallel_for(this, after.hashes.size(), 1, [&](size_t b, size_t, size_t) {
+        if (after.hashes[b] != before.hashes[b]) {
+            return;
+        }
+        for (size_t c = b * block_corners; c < std::min(corner_count, (b + 1) * block_corners) && stable; ++c) {
+            const GLuint s = slots[c];
+            if ((touched[s / 64] >> (s % 64)) & 1 && !same_position(verts[moved.value(s)], verts[c])) {
+                stable = false;
+            }
+        }
+    });
+    if (!okay || !stable) {
+        return nullptr;
+    }
+
+    MeshPatch* patch = new MeshPatch;
+    patch->slots.reserve(moved.size());
+    for (auto m = moved.constBegin(); m != moved.constEnd(); ++m) {
+        patch->slots.push_back(m.key());
+    }
+    std::sort(patch->slots.begin(), patch->slots.end());
+    patch->positions.reserve(patch->slots.size() * 3);
+    for (const GLuint s : patch->slots) {
+        const Vertex& v = verts[moved.value(s)];
+        patch->positions.insert(patch->positions.end(), {v.x, v.y, v.z});
+    }
+    profile.end(changed.size() * block_corners * sizeof(Vertex), patch->slots.size());
+    return patch;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+/*  Header at the start of a page file, followed by the page table */
+struct PageHeader {
+    char magic[8];
+    quint32 version;
+    quint32 page_count;
+    quint64 tri_count;
+};
+
+const char PAGE_MAGIC[8] = {'f', 's', 't', 'l', 'p', 'a', 'g', 'e'};
+const quint32 PAGE_VERSION = 1;
+
+/*  Spreads the low 10 bits of v out to every third bit */
+inline uint32_t spread_bits(uint32_t v)
+{
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+} // namespace
+
+bool Loader::needs_paging(QFile& file)
+{
+    // Only binary stls are paged, since their size gives away how many
+    // triangles they hold before anything has been decoded
+    const qint64 file_size = file.size();
+    bool paged = false;
+    if (file_size >= 84 && !file.fileName().startsWith(':')) {
+        const QByteArray header = file.read(84);
+        const auto line = header.startsWith("solid") ? header.split('\n').value(1).trimmed() : QByteArray();
+        const quint64 tri_count = qFromLittleEndian<quint32>(header.constData() + 80);
+        if (!line.startsWith("facet") && !line.startsWith("endsolid") && file_size == qint64(84 + tri_count * 50)) {
+#ifdef Q_OS_LINUX
+            const qint64 memory = qint64(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+            paged = memory > 0 && qint64(tri_count) * IN_CORE_BYTES > memory / 2;
+#endif
+        }
+    }
+    file.seek(0);
+    return paged;
+}
+
+void Loader::load_paged(QFile& file)
+{
+    const qint64 file_size = file.size();
+    const uchar* const data = file.map(0, file_size);
+    if (!data) {
+        emit error_bad_stl();
+        return;
+    }
+#ifdef Q_OS_UNIX
+    madvise(const_cast<uchar*>(data), file_size, MADV_SEQUENTIAL);
+#endif
+    const size_t tri_count = qFromLittleEndian<quint32>(data + 80);
+    auto triangle = [&](size_t t, Vertex* v) {
+        auto b = data + 84 + t * 50 + 3 * sizeof(float);
         for (unsigned i = 0; i < 3; ++i) {
-            qFromLittleEndian<float>(b, 3, &v[i]);
-            b += 3 * sizeof(float);
+            qFromLittleEndian<float>(b + i * 3 * sizeof(float), 3, &v[i]);
         }
+    };
+    const size_t BLOCK = 1 << 16;
 
-        // Skip face attribute and next face's normal vector
-        b += 3 * sizeof(float) + sizeof(uint16_t);
+    // The file is streamed three times, rather than ever decoded into
+    // memory as a whole.  The first pass gathers statistics, which give
+    // the bounds for the grid that the triangles are binned on.
+    profile.begin("decode");
+    std::vector<StatsTotals> block_totals((tri_count + BLOCK - 1) / BLOCK);
+    bool okay = parallel_for(this, tri_count, BLOCK, [&](size_t begin, size_t end, size_t block) {
+        Vertex v[3];
+        for (size_t t = begin; t < end; ++t) {
+            triangle(t, v);
+            block_totals[block].add(v[0], v[1], v[2]);
+        }
+    });
+    profile.end(file_size, tri_count);
+    if (!okay) {
+        file.unmap(const_cast<uchar*>(data));
+        return;
     }
+    StatsTotals totals;
+    for (const auto& b : block_totals) {
+        totals.merge(b);
+    }
+    MeshStats stats;
+    totals.finish(stats);
+
+    // The second pass counts the triangles whose centroids fall in each
+    // grid cell, with cells numbered along a Morton curve
+    const size_t cell_count = size_t(1) << (3 * PAGE_GRID_BITS);
+    const float grid = 1 << PAGE_GRID_BITS;
+    auto cell_of = [&](const Vertex* v) {
+        uint32_t code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float c = ((&v[0].x)[axis] + (&v[1].x)[axis] + (&v[2].x)[axis]) / 3;
+            const float extent = stats.upper[axis] - stats.lower[axis];
+            const float f = extent > 0 ? (c - stats.lower[axis]) / extent * grid : 0;
+            code |= spread_bits(f > 0 ? uint32_t(std::min(f, grid - 1)) : 0) << axis;
+        }
+        return code;
+    };
+    profile.begin("bin");
+    std::unique_ptr<std::atomic<quint64>[]> cells(new std::atomic<quint64>[cell_count]());
+    okay = parallel_for(this, tri_count, BLOCK, [&](size_t begin, size_t end, size_t) {
+        Vertex v[3];
+        for (size_t t = begin; t < end; ++t) {
+            triangle(t, v);
+            cells[cell_of(v)].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    profile.end(file_size, tri_count);
+    if (!okay) {
+        file.unmap(const_cast<uchar*>(data));
+        return;
+    }
+
+    // Runs of cells become pages, and each cell's count is replaced by
+    // the slot in the page file where its first triangle goes.  A cell
+    // that's too dense for one page is split across several.
+    std::vector<PagedMesh::Page> pages;
+    quint64 slot = 0;
+    for (size_t c = 0; c < cell_count; ++c) {
+        quint64 n = cells[c].load(std::memory_order_relaxed);
+        if (!n) {
+            continue;
+        } else if (pages.empty() || pages.back().tri_count >= PAGE_TRIANGLES) {
+            pages.push_back({{0, 0, 0}, {0, 0, 0}, slot, 0});
+        }
+        cells[c].store(slot, std::memory_order_relaxed);
+        while (pages.back().tri_count + n > MAX_PAGE_TRIANGLES) {
+            const quint64 fits = MAX_PAGE_TRIANGLES - pages.back().tri_count;
+            pages.back().tri_count += fits;
+            slot += fits;
+            n -= fits;
+            pages.push_back({{0, 0, 0}, {0, 0, 0}, slot, 0});
+        }
+        pages.back().tri_count += n;
+        slot += n;
+    }
+    const size_t TRIANGLE_BYTES = 3 * sizeof(Vertex);
+    const qint64 data_offset = sizeof(PageHeader) + pages.size() * sizeof(PagedMesh::Page);
+    const qint64 page_size = data_offset + tri_count * TRIANGLE_BYTES;
+    for (auto& page : pages) {
+        page.offset = data_offset + page.offset * TRIANGLE_BYTES;
+    }
+
+    // The page file goes in the cache directory, since the temporary
+    // directory may well be held in memory
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/pages";
+    QDir().mkpath(dir);
+    std::unique_ptr<QTemporaryFile> page_file(new QTemporaryFile(dir + "/XXXXXX.pages"));
+    uchar* out = nullptr;
+    if (!page_file->open() || !page_file->resize(page_size) || !(out = page_file->map(0, page_size))) {
+        file.unmap(const_cast<uchar*>(data));
+        emit error_page_file();
+        return;
+    }
+#ifdef Q_OS_UNIX
+    // Unlinking the open file means it can't be left behind, even if we
+    // crash; QTemporaryFile removes it on close everywhere else
+    QFile::remove(page_file->fileName());
+#endif
 
-    return mesh_from_verts(tri_count, verts);
+    // The third pass copies every triangle into its cell's next slot
+    profile.begin("page");
+    okay = parallel_for(this, tri_count, BLOCK, [&](size_t begin, size_t end, size_t) {
+        Vertex v[3];
+        for (size_t t = begin; t < end; ++t) {
+            triangle(t, v);
+            const quint64 s = cells[cell_of(v)].fetch_add(1, std::memory_order_relaxed);
+            memcpy(out + data_offset + s * TRIANGLE_BYTES, v, TRIANGLE_BYTES);
+        }
+    });
+    profile.end(page_size, tri_count);
+    file.unmap(const_cast<uchar*>(data));
+    cells.reset();
+
+    // Finally, each page is measured and clustered into its part of the
+    // overview.  Every page is clustered on the same grid, so the pages'
+    // overviews still meet along their edges.
+    std::vector<Mesh*> overview(pages.size(), nullptr);
+    const float cell_size = sqrt(2 * stats.area / OVERVIEW_TRIANGLES);
+    profile.begin("overview");
+    okay = okay && parallel_for(this, pages.size(), 1, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i) {
+            PagedMesh::Page& page = pages[i];
+            const GLfloat* const xyz = reinterpret_cast<const GLfloat*>(out + page.offset);
+            for (int axis = 0; axis < 3; ++axis) {
+                page.lower[axis] = INFINITY;
+                page.upper[axis] = -INFINITY;
+            }
+            for (size_t k = 0; k < page.tri_count * 9; ++k) {
+                page.lower[k % 3] = fmin(page.lower[k % 3], xyz[k]);
+                page.upper[k % 3] = fmax(page.upper[k % 3], xyz[k]);
+            }
+            if (stats.area > 0) {
+                overview[i] = decimate(xyz, nullptr, page.tri_count * 3, stats, cell_size);
+            }
+        }
+    });
+    qint64 overview_count = 0;
+    for (const auto m : overview) {
+        overview_count += m ? m->triCount() : 0;
+    }
+    profile.end(page_size, overview_count);
+
+    // Write the page table last, now that the pages' bounds are known
+    PageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PAGE_MAGIC, sizeof(PAGE_MAGIC));
+    header.version = PAGE_VERSION;
+    header.page_count = pages.size();
+    header.tri_count = tri_count;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), pages.data(), pages.size() * sizeof(PagedMesh::Page));
+    page_file->unmap(out);
+
+    if (!okay) {
+        for (const auto m : overview) {
+            delete m;
+        }
+        return;
+    }
+    profile.write_trace(filename);
+    emit got_paged_mesh(new PagedMesh(page_file.release(), std::move(pages), std::move(overview), stats), is_reload);
+    emit loaded_file(filename);
 }
 
-Mesh* Loader::read_stl_ascii(QFile& file)
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+inline bool is_blank(char c)
 {
-    file.readLine();
-    uint32_t tri_count = 0;
-    QVector<Vertex> verts(tri_count * 3);
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-    bool okay = true;
-    while (!file.atEnd() && okay) {
-        const auto line = file.readLine().simplified();
-        if (line.startsWith("endsolid")) {
-            break;
-        } else if (!line.startsWith("facet normal") || !file.readLine().simplified().startsWith("outer loop")) {
-            okay = false;
-            break;
+/*  One line of an ASCII stl, with leading whitespace already skipped */
+struct Line {
+    const char* p;
+    const char* end;
+
+    bool starts_with(const char* word) const
+    {
+        const size_t n = strlen(word);
+        return size_t(end - p) >= n && !memcmp(p, word, n);
+    }
+
+    /*  Consumes a keyword followed by whitespace (or the end of the line) */
+    bool consume(const char* word)
+    {
+        const size_t n = strlen(word);
+        if (!starts_with(word) || (p + n != end && !is_blank(p[n]))) {
+            return false;
+        }
+        p += n;
+        skip_blanks();
+        return true;
+    }
+
+    void skip_blanks()
+    {
+        while (p != end && is_blank(*p)) {
+            ++p;
+        }
+    }
+
+    /*  Consumes a whitespace-delimited float, returning false if the
+     *  token isn't one.  Plain decimal and exponent notation is parsed
+     *  inline, without allocating or touching the C locale; anything
+     *  more exotic (nan, inf, ...) is passed on to QByteArray::toFloat. */
+    bool consume_float(float* out)
+    {
+        const char* token_end = p;
+        while (token_end != end && !is_blank(*token_end)) {
+            ++token_end;
+        }
+        if (token_end == p) {
+            return false;
+        }
+
+        const char* c = p;
+        const bool negative = *c == '-';
+        if (*c == '-' || *c == '+') {
+            ++c;
+        }
+
+        // Keep up to 19 significant digits, which always fit in 64 bits
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool any_digits = false;
+        for (; c != token_end && *c >= '0' && *c <= '9'; ++c) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*c - '0');
+                digits += mantissa != 0;
+            } else {
+                exponent++;
+            }
+            any_digits = true;
+        }
+        if (c != token_end && *c == '.') {
+            for (++c; c != token_end && *c >= '0' && *c <= '9'; ++c) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*c - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+                any_digits = true;
+            }
+        }
+        if (any_digits && c != token_end && (*c == 'e' || *c == 'E')) {
+            ++c;
+            const bool negative_exponent = c != token_end && *c == '-';
+            if (c != token_end && (*c == '-' || *c == '+')) {
+                ++c;
+            }
+            int e = 0;
+            const char* const e_start = c;
+            for (; c != token_end && *c >= '0' && *c <= '9'; ++c) {
+                e = std::min(e * 10 + (*c - '0'), 100000);
+            }
+            exponent += (c == e_start) ? 100000 : (negative_exponent ? -e : e);
+        }
+
+        // Powers of ten past a double's range would turn a zero mantissa
+        // into 0 * inf = NaN, so they're left to the fallback
+        bool okay;
+        if (any_digits && c == token_end && std::abs(exponent) <= 308) {
+            static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            const int e = std::abs(exponent);
+            const double scale = e <= 22 ? powers[e] : std::pow(10.0, e);
+            double v = exponent < 0 ? mantissa / scale : mantissa * scale;
+            if (negative) {
+                v = -v;
+            }
+            *out = float(v);
+            okay = std::abs(v) <= std::numeric_limits<float>::max();
+        } else {
+            *out = QByteArray::fromRawData(p, token_end - p).toFloat(&okay);
+        }
+
+        p = token_end;
+        skip_blanks();
+        return okay;
+    }
+};
+
+/*  Returns the line starting at p (or an empty line past the end of the
+ *  file), advancing p to the start of the next line. */
+inline Line read_line(const char*& p, const char* end)
+{
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (!eol) {
+        eol = end;
+    }
+    Line line = {p, eol};
+    line.skip_blanks();
+    p = (eol == end) ? end : eol + 1;
+    return line;
+}
+
+/*  Returns the start of the first line after p that opens a facet */
+const char* find_facet(const char* p, const char* end)
+{
+    read_line(p, end);
+    while (p != end) {
+        const char* start = p;
+        if (read_line(p, end).starts_with("facet")) {
+            return start;
+        }
+    }
+    return end;
+}
+
+enum AsciiStatus { ASCII_OKAY, ASCII_ENDSOLID, ASCII_BAD };
+
+/*  Parses whole facets starting in [p, stop), appending their vertices to
+ *  verts.  The last facet may run past stop, but not past end. */
+AsciiStatus parse_ascii_facets(const char* p, const char* stop, const char* end, std::vector<Vertex>& verts)
+{
+    while (p < stop) {
+        Line line = read_line(p, end);
+        if (line.starts_with("endsolid")) {
+            return ASCII_ENDSOLID;
+        } else if (!line.consume("facet") || !line.starts_with("normal")) {
+            return ASCII_BAD;
+        }
+        line = read_line(p, end);
+        if (!line.consume("outer") || !line.starts_with("loop")) {
+            return ASCII_BAD;
         }
 
         for (int i = 0; i < 3; ++i) {
-            auto line = file.readLine().simplified().split(' ');
-            if (line[0] != "vertex") {
-                okay = false;
-                break;
-            }
-            const float x = line[1].toFloat(&okay);
-            const float y = line[2].toFloat(&okay);
-            const float z = line[3].toFloat(&okay);
-            verts.push_back(Vertex(x, y, z));
-        }
-        if (!file.readLine().trimmed().startsWith("endloop") || !file.readLine().trimmed().startsWith("endfacet")) {
-            okay = false;
+            line = read_line(p, end);
+            Vertex v;
+            if (!line.consume("vertex") || !line.consume_float(&v.x) || !line.consume_float(&v.y) || !line.consume_float(&v.z)) {
+                return ASCII_BAD;
+            }
+            verts.push_back(v);
+        }
+        if (!read_line(p, end).starts_with("endloop") || !read_line(p, end).starts_with("endfacet")) {
+            return ASCII_BAD;
+        }
+    }
+    return ASCII_OKAY;
+}
+} // namespace
+
+bool Loader::read_stl_ascii(QFile& file, Soup& verts)
+{
+    QByteArray fallback;
+    const char* const begin = reinterpret_cast<const char*>(map_file(file, fallback));
+    const char* const end = begin + file.size();
+
+    // Skip the "solid name" line
+    const char* start = begin;
+    read_line(start, end);
+
+    // Split the file into chunks of a few MB (and at least one per thread),
+    // with every chunk starting at a facet boundary, and parse the chunks
+    // in parallel.
+    const size_t chunks = (end - start) < (1 << 20) ? 1 : std::max<size_t>(worker_threads(), (end - start) >> 23);
+    std::vector<const char*> chunk_start(chunks + 1, end);
+    chunk_start[0] = start;
+    for (size_t c = 1; c < chunks; ++c) {
+        const char* nominal = start + (end - start) / chunks * c;
+        chunk_start[c] = find_facet(std::max(nominal, chunk_start[c - 1]), end);
+    }
+
+    std::vector<std::vector<Vertex>> chunk_verts(chunks);
+    std::vector<AsciiStatus> chunk_status(chunks);
+    bool okay = parallel_for(this, chunks, 1, [&](size_t first, size_t last, size_t) {
+        for (size_t t = first; t < last; ++t) {
+            // Facets are rarely shorter than ~160 bytes of text, so this
+            // over-estimates the number of vertices to avoid reallocation.
+            chunk_verts[t].reserve((chunk_start[t + 1] - chunk_start[t]) / 160 * 3 + 3);
+            chunk_status[t] = parse_ascii_facets(chunk_start[t], chunk_start[t + 1], end, chunk_verts[t]);
+        }
+    });
+
+    // Stitch the chunks back together, stopping at the first endsolid
+    // (just as a sequential parse would) and rejecting malformed facets.
+    if (!okay) {
+        return false;
+    }
+    std::vector<size_t> chunk_offset(chunks, 0);
+    size_t vertex_total = 0;
+    size_t chunk_count = 0;
+    while (chunk_count < chunks) {
+        const size_t t = chunk_count++;
+        if (chunk_status[t] == ASCII_BAD) {
+            emit error_bad_stl();
+            return false;
+        }
+        chunk_offset[t] = vertex_total;
+        vertex_total += chunk_verts[t].size();
+        if (chunk_status[t] == ASCII_ENDSOLID) {
             break;
         }
-        tri_count++;
     }
 
-    if (okay) {
-        return mesh_from_verts(tri_count, verts);
-    } else {
-        emit error_bad_stl();
-        return NULL;
+    verts.resize(vertex_total);
+    Vertex* const out = verts.data();
+    okay = parallel_for(this, chunk_count, 1, [&](size_t first, size_t last, size_t) {
+        for (size_t t = first; t < last; ++t) {
+            std::copy(chunk_verts[t].begin(), chunk_verts[t].end(), out + chunk_offset[t]);
+            std::vector<Vertex>().swap(chunk_verts[t]);
+        }
+    });
+
+    if (fallback.isEmpty()) {
+        file.unmap(reinterpret_cast<uchar*>(const_cast<char*>(begin)));
+    }
+
+    return okay;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+/*  Reverses the low bits of i.  Stepping i through 0, 1, 2, ... then
+ *  visits [0, 2^bits) in an order where every prefix is spread evenly. */
+inline size_t bit_reverse(size_t i, int bits)
+{
+    size_t out = 0;
+    for (int b = 0; b < bits; ++b) {
+        out = (out << 1) | ((i >> b) & 1);
+    }
+    return out;
+}
+} // namespace
+
+bool Loader::sample_stl(Soup& verts, size_t max_triangles, qint64 budget_ms)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    bool ascii = false;
+    if (file.read(5) == "solid") {
+        file.readLine();
+        const auto line = file.readLine().trimmed();
+        ascii = line.startsWith("facet") || line.startsWith("endsolid");
+    }
+
+    // Facets of an ASCII stl take up about 250 bytes.  Files that aren't
+    // much bigger than the sample are simply read in full, as are files
+    // that can't be mapped.
+    const qint64 file_size = file.size();
+    const qint64 triangle_bytes = ascii ? 250 : 50;
+    const uchar* data = (file_size - 84) / triangle_bytes > qint64(max_triangles) * 2 ? file.map(0, file_size) : nullptr;
+    if (!data) {
+        file.seek(0);
+        return load_stl(file, verts) && !verts.empty();
+    }
+#ifdef Q_OS_UNIX
+    madvise(const_cast<uchar*>(data), file_size, MADV_RANDOM);
+#endif
+
+    const uint32_t tri_count = ascii ? 0 : qFromLittleEndian<quint32>(data + 80);
+    if (!ascii && file_size != 84 + qint64(tri_count) * 50) {
+        file.unmap(const_cast<uchar*>(data));
+        return false;
+    }
+
+    // The file is split into strata, and a run of triangles is read from
+    // the start of each one.  Strata are visited in bit-reversed order,
+    // so that running out of time leaves a sparser sample of the whole
+    // model rather than a dense sample of one end of it.
+    int bits = 0;
+    while ((size_t(2) << bits) * SAMPLE_RUN <= max_triangles) {
+        bits++;
+    }
+    const size_t strata = size_t(1) << bits;
+    std::vector<Vertex> sample;
+    sample.reserve(strata * SAMPLE_RUN * 3);
+
+    const char* const text = reinterpret_cast<const char*>(data);
+    for (size_t k = 0; k < strata; ++k) {
+        if (k % 64 == 0 && timer.elapsed() > budget_ms) {
+            break;
+        }
+        const size_t s = bit_reverse(k, bits);
+        if (ascii) {
+            // Runs start at the first facet in the stratum, and a run whose
+            // text doesn't parse is skipped rather than failing the sample
+            const char* const end = text + file_size;
+            const char* const stratum_end = text + file_size * (s + 1) / strata;
+            const char* const p = find_facet(text + file_size * s / strata, end);
+            if (parse_ascii_facets(p, std::min(p + SAMPLE_RUN * triangle_bytes, stratum_end), end, sample) == ASCII_BAD) {
+                sample.resize(sample.size() - sample.size() % 3);
+            }
+        } else {
+            const size_t first = size_t(uint64_t(tri_count) * s / strata);
+            const size_t last = std::min<size_t>(first + SAMPLE_RUN, uint64_t(tri_count) * (s + 1) / strata);
+            for (auto b = data + 84 + first * 50 + 3 * sizeof(float); b < data + 84 + last * 50; b += 50) {
+                for (unsigned i = 0; i < 3; ++i) {
+                    Vertex v;
+                    qFromLittleEndian<float>(b + i * 3 * sizeof(float), 3, &v.x);
+                    sample.push_back(v);
+                }
+            }
+        }
     }
+    file.unmap(const_cast<uchar*>(data));
+
+    verts.swap(sample);
+    return !verts.empty();
 }
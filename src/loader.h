@@ -1,36 +1,168 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+#include <QSharedPointer>
 #include <QThread>
 
+#include "loadprofile.h"
 #include "mesh.h"
+#include "meshpatch.h"
+#include "pagedmesh.h"
+#include "vertex.h"
+
+/*  Whether the loader should quantize vertex positions to 16 bits */
+enum QuantizeMode { quantize_never, quantize_always, quantize_auto };
 
 class Loader : public QThread
 {
     Q_OBJECT
 public:
-    explicit Loader(QObject* parent, const QString& filename, bool is_reload);
+    explicit Loader(QObject* parent, const QString& filename, bool is_reload, QuantizeMode quantize = quantize_never);
     void run();
 
+    /*  Checks whether a newer load has asked this one to stop */
+    bool cancelled() const;
+
+    /*  Limits how many threads this load splits its work across, so that
+     *  several loads can share the machine (0 uses every core) */
+    void set_worker_threads(unsigned n);
+    unsigned worker_threads() const;
+
+    /*  Marks this load as a prefetch, which only emits the finished mesh
+     *  (skipping the triangle soup that's shown while it's welded) */
+    void set_prefetch(bool p);
+
+    /*  Has this load emit a snapshot of the file with got_snapshot, and
+     *  (if it's a reload) compare the file with the previous snapshot,
+     *  skipping the reload if nothing has changed or patching the mesh
+     *  that's already loaded if only some triangles have moved */
+    void set_incremental(bool i, const QSharedPointer<const FileSnapshot>& previous);
+
+    /*  Timings for each stage of the load, valid once run() returns */
+    const LoadProfile& load_profile() const;
+
+    /*  Reads an evenly spread sample of about max_triangles of the file's
+     *  triangles (or all of them, if there aren't many more) into verts,
+     *  for previews that have to be quick rather than complete.  Once
+     *  budget_ms have passed, this stops with whatever it has so far. */
+    bool sample_stl(Soup& verts, size_t max_triangles, qint64 budget_ms);
+
 protected:
-    Mesh* load_stl();
+    /*  Blocks until the file looks like it has been completely written */
+    void wait_for_writer(const QFile& file);
+
+    /*  Decodes the file into a triangle soup, returning false (after
+     *  emitting the relevant error signal) if it couldn't be read. */
+    bool load_stl(QFile& file, Soup& verts);
 
     /*  Reads an ASCII stl, starting from the start of the file*/
-    Mesh* read_stl_ascii(QFile& file);
-    /*  Reads a binary stl, assuming we're at the end of the header */
-    Mesh* read_stl_binary(QFile& file);
+    bool read_stl_ascii(QFile& file, Soup& verts);
+    /*  Reads a binary stl, starting from the start of the file */
+    bool read_stl_binary(QFile& file, Soup& verts);
+
+    /*  Checks whether a file is a binary stl too big to load into memory,
+     *  which has to be paged from disk instead */
+    bool needs_paging(QFile& file);
+    /*  Splits a binary stl into pages on disk in a few streaming passes,
+     *  then emits it with got_paged_mesh */
+    void load_paged(QFile& file);
+
+    /*  Computes bounds and other statistics of a triangle soup in one
+     *  pass, returning false if the load was cancelled part-way through */
+    bool stats_from_verts(const Soup& verts, MeshStats& stats);
+
+    /*  Hashes the file in blocks, returning false if the load was
+     *  cancelled part-way through */
+    bool hash_blocks(QFile& file, FileSnapshot& snapshot);
+
+    /*  Works out how to patch the mesh loaded with the before snapshot so
+     *  that it matches the triangle soup, returning NULL if the triangles
+     *  no longer share vertices in the same way (or too many changed) */
+    MeshPatch* patch_from_verts(const Soup& verts, const FileSnapshot& before, const FileSnapshot& after);
+
+    /*  Welds a triangle soup into an indexed mesh, returning NULL if the
+     *  load was cancelled part-way through.  Soups with more vertices than
+     *  32-bit slots can tell apart come back unwelded, still sharing verts. */
+    Mesh* mesh_from_verts(const SharedSoup& verts);
+
+    /*  Splits the mesh into chunks for drawing, and quantizes its
+     *  positions if the quantize mode asks for it.  If a snapshot is
+     *  given, it's filled in with what's needed to patch the mesh. */
+    void prepare_mesh(Mesh& mesh, LoadProfile& prof, FileSnapshot* snapshot = nullptr);
+
+    /*  Builds coarser levels of detail from a mesh (given as positions
+     *  and optional indices, or a triangle soup if indices is NULL) and
+     *  emits them with got_lod, finest first */
+    void build_lods(const GLfloat* xyz, const GLuint* indices, size_t corners, const MeshStats& stats);
+    /*  Whether build_lods does anything for a mesh of this size */
+    static bool wants_lods(size_t tri_count, const MeshStats& stats);
+
+    /*  Simplifies a mesh by clustering its vertices on a grid with the
+     *  given cell size, placing each cluster at the point that minimizes
+     *  its quadric error.  Returns NULL if cancelled part-way through. */
+    Mesh* decimate(const GLfloat* xyz, const GLuint* indices, size_t corners, const MeshStats& stats, float cell_size);
 
 signals:
     void loaded_file(QString filename);
     void got_mesh(Mesh* m, bool is_reload);
+    /*  Emitted after loaded_file with each level of detail, where level n
+     *  has about 4^-n as many triangles as the full mesh */
+    void got_lod(Mesh* m, int level);
+    /*  Emitted instead of got_mesh for files that are paged from disk */
+    void got_paged_mesh(PagedMesh* m, bool is_reload);
+    /*  Emitted instead of got_mesh when an incremental reload patches
+     *  the loaded mesh */
+    void got_patch(MeshPatch* p);
+    /*  Emitted once an incremental load has finished with the file */
+    void got_snapshot(FileSnapshot* s);
 
     void error_bad_stl();
     void error_empty_mesh();
     void error_missing_file();
+    /*  Emitted if a file that needs paging couldn't be written to disk */
+    void error_page_file();
 
 private:
     const QString filename;
     bool is_reload;
+    QuantizeMode quantize;
+    unsigned max_threads;
+    bool prefetch;
+    bool incremental;
+    QSharedPointer<const FileSnapshot> previous;
+    LoadProfile profile;
+
+    /*  In quantize_auto mode, meshes with at least this many triangles
+     *  are quantized */
+    const static int QUANTIZE_TRIANGLES = 10000000;
+
+    /*  Meshes with at least this many triangles get LOD_LEVELS levels of
+     *  detail to draw while the view is moving */
+    const static size_t LOD_TRIANGLES = 1000000;
+    const static int LOD_LEVELS = 3;
+
+    /*  Files are paged if loading them into memory, which takes about
+     *  IN_CORE_BYTES per triangle at its peak, would need more than half
+     *  of the machine's memory */
+    const static qint64 IN_CORE_BYTES = 100;
+    /*  Paged files are binned on a grid with this many bits per axis,
+     *  and runs of cells along a Morton curve are gathered into pages of
+     *  at least PAGE_TRIANGLES and at most MAX_PAGE_TRIANGLES.  The pages'
+     *  overviews add up to about OVERVIEW_TRIANGLES. */
+    const static int PAGE_GRID_BITS = 6;
+    const static size_t PAGE_TRIANGLES = 1 << 18;
+    const static size_t MAX_PAGE_TRIANGLES = 1 << 20;
+    const static size_t OVERVIEW_TRIANGLES = 4 << 20;
+
+    /*  Reloads that would change more than 1 / PATCH_FRACTION of the
+     *  triangles are done in full rather than patched */
+    const static size_t PATCH_FRACTION = 4;
+
+    /*  Files modified less than this long ago may still be being written */
+    const static int SETTLE_MS = 1000;
+
+    /*  Samples are read in runs of this many consecutive triangles */
+    const static size_t SAMPLE_RUN = 64;
 };
 
 #endif // LOADER_H
@@ -0,0 +1,191 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+
+#include <cstring>
+
+#include "loadprofile.h"
+
+#ifdef Q_OS_UNIX
+#    include <sys/resource.h>
+#endif
+
+namespace
+{
+/*  Stage start times are measured from a shared clock, so that profiles
+ *  recorded on different threads line up in the trace. */
+qint64 now_ns()
+{
+    static QElapsedTimer clock = []() {
+        QElapsedTimer c;
+        c.start();
+        return c;
+    }();
+    return clock.nsecsElapsed();
+}
+
+QString& trace_file()
+{
+    static QString path = QString::fromLocal8Bit(qgetenv("FSTL_TRACE"));
+    return path;
+}
+
+bool& stage_peaks()
+{
+    static bool enabled = false;
+    return enabled;
+}
+
+/*  On Linux, the peak RSS counter can be reset so that each stage reports
+ *  its own peak rather than the peak of the whole process so far. */
+void reset_peak_rss()
+{
+#ifdef Q_OS_LINUX
+    if (!stage_peaks()) {
+        return;
+    }
+    QFile clear_refs("/proc/self/clear_refs");
+    if (clear_refs.open(QIODevice::WriteOnly)) {
+        clear_refs.write("5");
+    }
+#endif
+}
+} // namespace
+
+LoadProfile::LoadProfile() : open(false)
+{
+    // Nothing to do here
+}
+
+void LoadProfile::begin(const char* name)
+{
+    if (open) {
+        end();
+    }
+    reset_peak_rss();
+    list.push_back({name, now_ns(), 0, 0, 0, -1});
+    open = true;
+}
+
+void LoadProfile::end(qint64 bytes, qint64 items)
+{
+    if (!open) {
+        return;
+    }
+    Stage& stage = list.last();
+    stage.duration_ns = now_ns() - stage.start_ns;
+    stage.bytes = bytes;
+    stage.items = items;
+    stage.peak_rss = peak_rss();
+    open = false;
+}
+
+const QVector<LoadProfile::Stage>& LoadProfile::stages() const
+{
+    return list;
+}
+
+const LoadProfile::Stage* LoadProfile::stage(const char* name) const
+{
+    for (const auto& stage : list) {
+        if (!strcmp(stage.name, name)) {
+            return &stage;
+        }
+    }
+    return nullptr;
+}
+
+qint64 LoadProfile::total_ns() const
+{
+    qint64 total = 0;
+    for (const auto& stage : list) {
+        total += stage.duration_ns;
+    }
+    return total;
+}
+
+QString LoadProfile::trace_path()
+{
+    return trace_file();
+}
+
+void LoadProfile::set_trace_path(const QString& path)
+{
+    trace_file() = path;
+}
+
+void LoadProfile::set_stage_peaks(bool enabled)
+{
+    stage_peaks() = enabled;
+}
+
+void LoadProfile::write_trace(const QString& label) const
+{
+    const QString path = trace_path();
+    if (path.isEmpty() || list.isEmpty()) {
+        return;
+    }
+
+    // Events use the JSON array format, whose closing bracket is optional,
+    // so that every load can be appended without rewriting the file.
+    QByteArray events;
+    for (const auto& stage : list) {
+        QJsonObject args;
+        args["file"] = label;
+        args["bytes"] = stage.bytes;
+        args["items"] = stage.items;
+        args["peak_rss"] = stage.peak_rss;
+
+        QJsonObject event;
+        event["name"] = stage.name;
+        event["cat"] = "load";
+        event["ph"] = "X";
+        event["ts"] = stage.start_ns / 1000.0;
+        event["dur"] = stage.duration_ns / 1000.0;
+        event["pid"] = QCoreApplication::applicationPid();
+        event["tid"] = qint64(quintptr(QThread::currentThreadId()));
+        event["args"] = args;
+        events += QJsonDocument(event).toJson(QJsonDocument::Compact) + ",\n";
+    }
+
+    // The loader and canvas write from different threads
+    static QMutex mutex;
+    QMutexLocker lock(&mutex);
+    QFile file(path);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        if (file.size() == 0) {
+            file.write("[\n");
+        }
+        file.write(events);
+    }
+}
+
+qint64 LoadProfile::peak_rss()
+{
+#if defined(Q_OS_LINUX)
+    // VmHWM follows resets through clear_refs, unlike getrusage
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly)) {
+        for (const auto& line : status.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).simplified().split(' ').first().toLongLong() * 1024;
+            }
+        }
+    }
+    return -1;
+#elif defined(Q_OS_MACOS)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss * 1024;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,59 @@
+#ifndef LOADPROFILE_H
+#define LOADPROFILE_H
+
+#include <QString>
+#include <QVector>
+
+/*
+ *  Records how long each stage of loading a mesh took, how much data it
+ *  went through, and the peak resident memory while it ran.
+ */
+class LoadProfile
+{
+public:
+    struct Stage {
+        const char* name;
+        qint64 start_ns;
+        qint64 duration_ns;
+        qint64 bytes;
+        qint64 items;
+        qint64 peak_rss;
+    };
+
+    LoadProfile();
+
+    /*  Starts timing a stage, ending the previous one if it's still open */
+    void begin(const char* name);
+    /*  Ends the current stage, recording how much data it processed */
+    void end(qint64 bytes = 0, qint64 items = 0);
+
+    const QVector<Stage>& stages() const;
+    /*  Returns the named stage, or nullptr if it never ran */
+    const Stage* stage(const char* name) const;
+    qint64 total_ns() const;
+
+    /*  Appends every stage as a Chrome trace event (viewable in
+     *  chrome://tracing or Perfetto) to the trace file, if one is set.
+     *  The label is attached to each event to tell loads apart. */
+    void write_trace(const QString& label) const;
+
+    /*  The trace file defaults to $FSTL_TRACE, and is disabled if empty */
+    static QString trace_path();
+    static void set_trace_path(const QString& path);
+
+    /*  Has every stage reset the process's peak RSS counter as it begins
+     *  (on Linux), so that each stage reports its own peak rather than the
+     *  peak so far.  The counter is process-wide, so this only makes sense
+     *  when one profile is running at a time, as in fstl-bench. */
+    static void set_stage_peaks(bool enabled);
+
+    /*  Peak resident set size of the process in bytes, or -1 if the
+     *  platform doesn't report it */
+    static qint64 peak_rss();
+
+private:
+    QVector<Stage> list;
+    bool open;
+};
+
+#endif // LOADPROFILE_H
@@ -1,6 +1,7 @@
 #include <QApplication>
 
 #include "app.h"
+#include "singleinstance.h"
 
 int main(int argc, char* argv[])
 {
@@ -12,6 +13,16 @@ int main(int argc, char* argv[])
     QCoreApplication::setApplicationName("fstl");
     QCoreApplication::setApplicationVersion(FSTL_VERSION);
     QGuiApplication::setDesktopFileName("fstlapp-fstl.desktop");
+
+    // In single-instance mode, a running fstl is asked to open the files
+    // instead, which only needs a core application rather than a window
+    if (SingleInstance::enabled()) {
+        QCoreApplication core(argc, argv);
+        if (SingleInstance::forward(core.arguments().mid(1))) {
+            return 0;
+        }
+    }
+
     App a(argc, argv);
 
     return a.exec();
@@ -2,47 +2,368 @@
 #include <QFile>
 #include <QVector3D>
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 #include "mesh.h"
+#include "workspace.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Mesh::Mesh(std::vector<GLfloat>&& v, std::vector<GLuint>&& i) : vertices(std::move(v)), indices(std::move(i))
+Mesh::Mesh(std::vector<GLfloat>&& v, std::vector<GLuint>&& i) : vertices(std::move(v)), indices(std::move(i)), has_stats(false)
 {
     // Nothing to do here
 }
 
+Mesh::Mesh(const SharedSoup& soup) : soup(soup), has_stats(false)
+{
+    static_assert(sizeof(Vertex) == 3 * sizeof(GLfloat), "Vertex must be tightly packed");
+}
+
+Mesh::Mesh(const SharedSoup& soup, std::vector<GLuint>&& first, std::vector<GLuint>&& i) :
+    indices(std::move(i)), soup(soup), soup_index(std::move(first)), has_stats(false)
+{
+    // Nothing to do here
+}
+
+const GLfloat* Mesh::vertexData() const
+{
+    if (quantized() || !soup_index.empty()) {
+        return nullptr;
+    }
+    if (indexed()) {
+        return vertices.data();
+    }
+    return soup ? reinterpret_cast<const GLfloat*>(soup->data()) : nullptr;
+}
+
+size_t Mesh::vertexFloats() const
+{
+    if (!soup_index.empty()) {
+        return soup_index.size() * 3;
+    }
+    return indexed() ? vertices.size() : (soup ? soup->size() * 3 : 0);
+}
+
+const void* Mesh::vertexBuffer() const
+{
+    return quantized() ? static_cast<const void*>(packed.data()) : vertexData();
+}
+
+size_t Mesh::vertexBufferSize() const
+{
+    return quantized() ? packed.size() * sizeof(GLushort) : vertexFloats() * sizeof(GLfloat);
+}
+
+size_t Mesh::vertexCount() const
+{
+    return quantized() ? packed.size() / 3 : vertexFloats() / 3;
+}
+
+void Mesh::quantize()
+{
+    if (quantized() || !has_stats || vertices.empty()) {
+        return;
+    }
+
+    const QVector3D offset = mesh_stats.lower;
+    const QVector3D scale = mesh_stats.upper - mesh_stats.lower;
+    float inverse[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        inverse[axis] = scale[axis] > 0 ? 65535 / scale[axis] : 0;
+    }
+
+    packed.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const int axis = i % 3;
+        const float q = (vertices[i] - offset[axis]) * inverse[axis] + 0.5f;
+        packed[i] = q >= 65535 ? 65535 : (q > 0 ? GLushort(q) : 0);
+    }
+
+    // Release the float positions, rather than just clearing them
+    std::vector<GLfloat>().swap(vertices);
+}
+
+bool Mesh::quantized() const
+{
+    return !packed.empty();
+}
+
+QVector3D Mesh::positionOffset() const
+{
+    return quantized() ? mesh_stats.lower : QVector3D(0, 0, 0);
+}
+
+QVector3D Mesh::positionScale() const
+{
+    return quantized() ? mesh_stats.upper - mesh_stats.lower : QVector3D(1, 1, 1);
+}
+
+float Mesh::quantizationError() const
+{
+    if (!quantized()) {
+        return 0;
+    }
+    const QVector3D scale = positionScale();
+    return std::max(scale.x(), std::max(scale.y(), scale.z())) / (2 * 65535);
+}
+
+void Mesh::setStats(const MeshStats& stats)
+{
+    mesh_stats = stats;
+    has_stats = true;
+}
+
+const MeshStats* Mesh::stats() const
+{
+    return has_stats ? &mesh_stats : nullptr;
+}
+
+const void* Mesh::indexBuffer() const
+{
+    return chunk_list.empty() ? static_cast<const void*>(indices.data()) : chunk_indices.data();
+}
+
+size_t Mesh::indexBufferSize() const
+{
+    return chunk_list.empty() ? indices.size() * sizeof(GLuint) : chunk_indices.size() * sizeof(GLushort);
+}
+
+namespace
+{
+/*  Spreads the low 10 bits of v out to every third bit */
+uint32_t spread_bits(uint32_t v)
+{
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+/*  Appends the subtree covering chunks [begin, end), splitting ranges in
+ *  half; since the chunks follow a space-filling curve, each half is
+ *  spatially compact too. */
+void build_chunk_tree(std::vector<ChunkNode>& tree, const std::vector<MeshChunk>& chunks, GLuint begin, GLuint end)
+{
+    ChunkNode node = {{INFINITY, INFINITY, INFINITY}, {-INFINITY, -INFINITY, -INFINITY}, begin, end - begin, 0};
+    for (GLuint c = begin; c < end; ++c) {
+        for (int axis = 0; axis < 3; ++axis) {
+            node.lower[axis] = std::min(node.lower[axis], chunks[c].lower[axis]);
+            node.upper[axis] = std::max(node.upper[axis], chunks[c].upper[axis]);
+        }
+    }
+    const size_t index = tree.size();
+    tree.push_back(node);
+    if (end - begin > 1) {
+        const GLuint mid = begin + (end - begin) / 2;
+        build_chunk_tree(tree, chunks, begin, mid);
+        build_chunk_tree(tree, chunks, mid, end);
+    }
+    tree[index].skip = tree.size();
+}
+} // namespace
+
+void Mesh::chunk(std::vector<GLuint>* corner_slots)
+{
+    if (indices.empty() || quantized() || !chunk_list.empty()) {
+        return;
+    }
+    const size_t tri_count = indices.size() / 3;
+    const size_t vertex_count = vertexCount();
+
+    // Positions come either from the flat vertex array or from the soup
+    // that this mesh was welded from
+    const GLfloat* const flat = soup_index.empty() ? vertices.data() : nullptr;
+    const GLfloat* const soup_xyz = reinterpret_cast<const GLfloat*>(soup ? soup->data() : nullptr);
+    auto position = [&](GLuint v) { return flat ? flat + size_t(v) * 3 : soup_xyz + size_t(soup_index[v]) * 3; };
+
+    // The scratch arrays are as big as the mesh, so they come from the
+    // workspace rather than being allocated afresh on every reload
+    Workspace::Buffer order_memory = Workspace::acquire(tri_count * sizeof(GLuint));
+    Workspace::Buffer sorted_memory;
+    GLuint* order = order_memory.as<GLuint>();
+    for (size_t t = 0; t < tri_count; ++t) {
+        order[t] = t;
+    }
+
+    // Sort triangles by the Morton code of their centroids (10 bits per
+    // axis within the bounding box), using a three-pass radix sort.
+    if (has_stats) {
+        const QVector3D extent = mesh_stats.upper - mesh_stats.lower;
+        float inverse[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            inverse[axis] = extent[axis] > 0 ? 1023 / (3 * extent[axis]) : 0;
+        }
+        Workspace::Buffer codes_memory = Workspace::acquire(tri_count * sizeof(uint32_t));
+        uint32_t* const codes = codes_memory.as<uint32_t>();
+        for (size_t t = 0; t < tri_count; ++t) {
+            const GLfloat* const a = position(indices[t * 3]);
+            const GLfloat* const b = position(indices[t * 3 + 1]);
+            const GLfloat* const c = position(indices[t * 3 + 2]);
+            uint32_t code = 0;
+            for (int axis = 0; axis < 3; ++axis) {
+                const float sum = a[axis] + b[axis] + c[axis] - 3 * mesh_stats.lower[axis];
+                const float f = sum * inverse[axis];
+                code |= spread_bits(f > 0 ? uint32_t(std::min(f, 1023.0f)) : 0) << axis;
+            }
+            codes[t] = code;
+        }
+
+        sorted_memory = Workspace::acquire(tri_count * sizeof(GLuint));
+        GLuint* sorted = sorted_memory.as<GLuint>();
+        for (int shift = 0; shift < 30; shift += 10) {
+            std::vector<size_t> offsets(1025);
+            for (size_t t = 0; t < tri_count; ++t) {
+                offsets[((codes[t] >> shift) & 1023) + 1]++;
+            }
+            for (size_t d = 1; d < offsets.size(); ++d) {
+                offsets[d] += offsets[d - 1];
+            }
+            for (size_t t = 0; t < tri_count; ++t) {
+                const GLuint tri = order[t];
+                sorted[offsets[(codes[tri] >> shift) & 1023]++] = tri;
+            }
+            std::swap(order, sorted);
+        }
+    }
+
+    // Triangles are added to the current chunk in sorted order until it's
+    // full, either of triangles (which keeps chunks small enough to cull)
+    // or of vertices (which must fit in 16-bit indices).  Neighbouring
+    // triangles mostly share vertices, so only vertices on the seams
+    // between chunks end up being copied twice.
+    Workspace::Buffer owner_memory = Workspace::acquire(vertex_count * sizeof(GLuint));
+    Workspace::Buffer local_memory = Workspace::acquire(vertex_count * sizeof(GLushort));
+    GLuint* const owner = owner_memory.as<GLuint>();
+    GLushort* const local = local_memory.as<GLushort>();
+    std::fill(owner, owner + vertex_count, std::numeric_limits<GLuint>::max());
+    std::vector<GLfloat> chunk_vertices;
+    chunk_vertices.reserve(vertex_count * 3 + vertex_count * 3 / 8);
+    chunk_indices.resize(indices.size());
+    if (corner_slots) {
+        corner_slots->resize(indices.size());
+    }
+
+    GLuint chunk_id = 0;
+    MeshChunk current = {0, 0, 0, 0, {}, {}};
+    for (size_t t = 0; t < tri_count; ++t) {
+        const GLuint* const tri = &indices[size_t(order[t]) * 3];
+        GLuint fresh = 0;
+        for (int k = 0; k < 3; ++k) {
+            fresh += owner[tri[k]] != chunk_id;
+        }
+        if (current.vertex_count + fresh > CHUNK_VERTICES || current.index_count >= 3 * CHUNK_TRIANGLES) {
+            chunk_list.push_back(current);
+            chunk_id++;
+            current = {current.first_vertex + current.vertex_count, 0, GLuint(t * 3), 0, {}, {}};
+        }
+        for (int k = 0; k < 3; ++k) {
+            const GLuint v = tri[k];
+            if (owner[v] != chunk_id) {
+                owner[v] = chunk_id;
+                local[v] = current.vertex_count++;
+                const GLfloat* const p = position(v);
+                chunk_vertices.insert(chunk_vertices.end(), p, p + 3);
+            }
+            chunk_indices[t * 3 + k] = local[v];
+            if (corner_slots) {
+                (*corner_slots)[size_t(order[t]) * 3 + k] = current.first_vertex + local[v];
+            }
+        }
+        current.index_count += 3;
+    }
+    chunk_list.push_back(current);
+
+    vertices.swap(chunk_vertices);
+    std::vector<GLuint>().swap(indices);
+    std::vector<GLuint>().swap(soup_index);
+    soup.reset();
+
+    for (auto& c : chunk_list) {
+        for (int axis = 0; axis < 3; ++axis) {
+            c.lower[axis] = INFINITY;
+            c.upper[axis] = -INFINITY;
+        }
+        for (size_t i = c.first_vertex * 3; i < (c.first_vertex + c.vertex_count) * 3; i += 3) {
+            for (int axis = 0; axis < 3; ++axis) {
+                c.lower[axis] = fmin(c.lower[axis], vertices[i + axis]);
+                c.upper[axis] = fmax(c.upper[axis], vertices[i + axis]);
+            }
+        }
+    }
+    build_chunk_tree(chunk_tree, chunk_list, 0, chunk_list.size());
+}
+
+const std::vector<MeshChunk>& Mesh::chunks() const
+{
+    return chunk_list;
+}
+
+const std::vector<ChunkNode>& Mesh::chunkTree() const
+{
+    return chunk_tree;
+}
+
+float Mesh::coordinate(size_t i) const
+{
+    // Positions may be quantized, still in the soup, or in the flat array
+    const int axis = int(i % 3);
+    if (quantized()) {
+        return positionOffset()[axis] + positionScale()[axis] * packed[i] / 65535.0f;
+    } else if (!soup_index.empty()) {
+        return reinterpret_cast<const GLfloat*>(soup->data())[size_t(soup_index[i / 3]) * 3 + axis];
+    }
+    return vertexData()[i];
+}
+
 float Mesh::min(size_t start) const
 {
-    if (start >= vertices.size()) {
+    if (has_stats && start < 3) {
+        return mesh_stats.lower[start];
+    }
+    const size_t size = vertexCount() * 3;
+    if (start >= size) {
         return -1;
     }
-    float v = vertices[start];
-    for (size_t i = start; i < vertices.size(); i += 3) {
-        v = fmin(v, vertices[i]);
+    float v = coordinate(start);
+    for (size_t i = start; i < size; i += 3) {
+        v = fmin(v, coordinate(i));
     }
     return v;
 }
 
 float Mesh::max(size_t start) const
 {
-    if (start >= vertices.size()) {
+    if (has_stats && start < 3) {
+        return mesh_stats.upper[start];
+    }
+    const size_t size = vertexCount() * 3;
+    if (start >= size) {
         return 1;
     }
-    float v = vertices[start];
-    for (size_t i = start; i < vertices.size(); i += 3) {
-        v = fmax(v, vertices[i]);
+    float v = coordinate(start);
+    for (size_t i = start; i < size; i += 3) {
+        v = fmax(v, coordinate(i));
     }
     return v;
 }
 
 int Mesh::triCount() const
 {
-    return indices.size() / 3;
+    if (!chunk_list.empty()) {
+        return chunk_indices.size() / 3;
+    }
+    return indexed() ? indices.size() / 3 : (soup ? soup->size() / 3 : 0);
 }
 
 bool Mesh::empty() const
 {
-    return vertices.size() == 0;
+    return vertexCount() == 0;
+}
+
+bool Mesh::indexed() const
+{
+    return !indices.empty() || !chunk_list.empty();
 }
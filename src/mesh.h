@@ -1,19 +1,83 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <QSharedPointer>
 #include <QString>
 #include <QtOpenGL/QtOpenGL>
 
 #include <vector>
 
+#include "vertex.h"
+
+/*  A triangle soup, three vertices per triangle.  It's a std::vector since
+ *  a QVector can't grow past 2 GB, and the meshes built from it share it
+ *  rather than copying it. */
+typedef std::vector<Vertex> Soup;
+typedef QSharedPointer<const Soup> SharedSoup;
+
+/*  Summary statistics of a mesh, computed by the loader in a single pass
+ *  over its triangles */
+struct MeshStats {
+    QVector3D lower, upper;
+
+    double area;
+    /*  Signed volume, positive for closed meshes with outward normals */
+    double volume;
+    /*  Area-weighted centroid of the surface */
+    QVector3D centroid;
+
+    /*  Distribution of triangle edge lengths (edges shared between two
+     *  triangles are counted twice) */
+    float edge_min, edge_max;
+    double edge_mean, edge_stddev;
+};
+
+/*  A run of nearby triangles that only use a window of at most
+ *  CHUNK_VERTICES consecutive vertices, so that they can be drawn with
+ *  16-bit indices relative to the window's first vertex */
+struct MeshChunk {
+    GLuint first_vertex;
+    GLuint vertex_count;
+    GLuint first_index;
+    GLuint index_count;
+    float lower[3], upper[3];
+};
+
+/*  A node in the bounding volume hierarchy over a mesh's chunks.  Nodes
+ *  are stored in depth-first order, and each one covers a consecutive
+ *  range of chunks; skip is the index of the first node after its
+ *  subtree. */
+struct ChunkNode {
+    float lower[3], upper[3];
+    GLuint first_chunk;
+    GLuint chunk_count;
+    GLuint skip;
+};
+
 class Mesh
 {
 public:
     Mesh(std::vector<GLfloat>&& vertices, std::vector<GLuint>&& indices);
 
+    /*  Builds a non-indexed mesh from a triangle soup (three vertices per
+     *  triangle).  The soup is shared rather than copied. */
+    explicit Mesh(const SharedSoup& soup);
+
+    /*  Builds an indexed mesh whose vertices are still in the triangle soup
+     *  they were welded from, with vertex v at soup[first[v]].  The soup is
+     *  shared rather than copied, and chunk() gathers the positions from it
+     *  straight into the chunked layout. */
+    Mesh(const SharedSoup& soup, std::vector<GLuint>&& first, std::vector<GLuint>&& indices);
+
     float min(size_t start) const;
     float max(size_t start) const;
 
+    /*  Records precomputed statistics, so that min() and max() don't
+     *  need to scan the vertex array */
+    void setStats(const MeshStats& stats);
+    /*  Returns the statistics, or nullptr if they were never computed */
+    const MeshStats* stats() const;
+
     float xmin() const
     {
         return min(0);
@@ -41,12 +105,66 @@ public:
 
     int triCount() const;
     bool empty() const;
+    bool indexed() const;
+
+    /*  Sorts the triangles of an indexed mesh along a space-filling curve
+     *  and splits them into chunks, giving each chunk its own copy of the
+     *  vertices it uses and switching to 16-bit indices.  This must happen
+     *  before quantization.  If corner_slots is given, it's filled with the
+     *  vertex that each corner of the original index array ended up at. */
+    void chunk(std::vector<GLuint>* corner_slots = nullptr);
+    const std::vector<MeshChunk>& chunks() const;
+    const std::vector<ChunkNode>& chunkTree() const;
+    const static size_t CHUNK_VERTICES = 65536;
+    const static size_t CHUNK_TRIANGLES = 16384;
+
+    /*  Replaces the float positions with 16-bit fixed-point positions
+     *  within the bounding box, halving the memory they take up.  The
+     *  statistics must already be set, since they provide the box. */
+    void quantize();
+    bool quantized() const;
+    /*  Stored positions p decode to offset + scale * p, where quantized
+     *  positions are normalized to [0, 1] (and float positions use the
+     *  identity).  Quantized positions are at most quantizationError()
+     *  away from the originals. */
+    QVector3D positionOffset() const;
+    QVector3D positionScale() const;
+    float quantizationError() const;
+
+    /*  Raw vertex buffer, in whichever format this mesh stores positions */
+    const void* vertexBuffer() const;
+    size_t vertexBufferSize() const;
+    size_t vertexCount() const;
+
+    /*  Flat xyz coordinates, from whichever storage this mesh uses (or
+     *  nullptr if the positions have been quantized, or are still spread
+     *  through the soup they were welded from) */
+    const GLfloat* vertexData() const;
+    size_t vertexFloats() const;
+    /*  Raw index buffer, holding 16-bit indices once the mesh has been
+     *  chunked and 32-bit indices before that (empty for triangle soups) */
+    const void* indexBuffer() const;
+    size_t indexBufferSize() const;
 
 private:
+    /*  Coordinate i of the flat xyz positions, decoded from whichever
+     *  storage this mesh uses */
+    float coordinate(size_t i) const;
+
     std::vector<GLfloat> vertices;
     std::vector<GLuint> indices;
+    SharedSoup soup;
+    std::vector<GLuint> soup_index;
+    std::vector<GLushort> packed;
+    std::vector<GLushort> chunk_indices;
+    std::vector<MeshChunk> chunk_list;
+    std::vector<ChunkNode> chunk_tree;
+
+    bool has_stats;
+    MeshStats mesh_stats;
 
     friend class GLMesh;
+    friend class MeshCache;
 };
 
 #endif // MESH_H
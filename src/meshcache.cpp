@@ -0,0 +1,202 @@
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "mesh.h"
+#include "meshcache.h"
+#include "meshpatch.h"
+
+const QString MeshCache::CACHE_SIZE_KEY = "meshCacheSizeMB";
+
+namespace
+{
+/*  Bump this whenever the entry layout changes */
+const quint32 CACHE_VERSION = 2;
+
+struct CacheHeader {
+    char magic[8];
+    quint32 version;
+    quint32 reserved;
+    quint64 vertex_floats;
+    quint64 index_count;
+    float lower[3];
+    float upper[3];
+    double area;
+    double volume;
+    float centroid[3];
+    float edge_min;
+    float edge_max;
+    float padding;
+    double edge_mean;
+    double edge_stddev;
+};
+
+const char CACHE_MAGIC[8] = {'f', 's', 't', 'l', 'm', 'e', 's', 'h'};
+} // namespace
+
+MeshCache::MeshCache(QFile& file, const FileSnapshot& contents) : budget(0)
+{
+    const QFileInfo info(file);
+    if (file.fileName().startsWith(':') || !info.exists()) {
+        return;
+    }
+
+    QSettings settings;
+    budget = settings.value(CACHE_SIZE_KEY, 2048).toLongLong() << 20;
+    if (budget <= 0) {
+        return;
+    }
+
+    // The loader has already hashed every block of the file in parallel,
+    // so the key only has to combine those hashes
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(contents.size));
+    hash.addData(contents.binary ? "binary" : "ascii");
+    hash.addData(reinterpret_cast<const char*>(contents.hashes.constData()), contents.hashes.size() * sizeof(quint64));
+
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes";
+    entry_path = dir + "/" + QString::fromLatin1(hash.result().toHex()) + ".mesh";
+}
+
+Mesh* MeshCache::load() const
+{
+    if (entry_path.isEmpty()) {
+        return NULL;
+    }
+
+    QFile entry(entry_path);
+    if (!entry.open(QIODevice::ReadOnly) || entry.size() < qint64(sizeof(CacheHeader))) {
+        return NULL;
+    }
+
+    const uchar* data = entry.map(0, entry.size());
+    if (!data) {
+        return NULL;
+    }
+
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || header.version != CACHE_VERSION ||
+        entry.size() != qint64(sizeof(header) + header.vertex_floats * sizeof(GLfloat) + header.index_count * sizeof(GLuint))) {
+        return NULL;
+    }
+
+    const uchar* v = data + sizeof(header);
+    const uchar* i = v + header.vertex_floats * sizeof(GLfloat);
+    std::vector<GLfloat> vertices(header.vertex_floats);
+    std::vector<GLuint> indices(header.index_count);
+    memcpy(vertices.data(), v, vertices.size() * sizeof(GLfloat));
+    memcpy(indices.data(), i, indices.size() * sizeof(GLuint));
+
+    // Touch the entry, so that eviction sees it as recently used
+    entry.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    MeshStats stats;
+    stats.lower = QVector3D(header.lower[0], header.lower[1], header.lower[2]);
+    stats.upper = QVector3D(header.upper[0], header.upper[1], header.upper[2]);
+    stats.area = header.area;
+    stats.volume = header.volume;
+    stats.centroid = QVector3D(header.centroid[0], header.centroid[1], header.centroid[2]);
+    stats.edge_min = header.edge_min;
+    stats.edge_max = header.edge_max;
+    stats.edge_mean = header.edge_mean;
+    stats.edge_stddev = header.edge_stddev;
+
+    Mesh* mesh = new Mesh(std::move(vertices), std::move(indices));
+    mesh->setStats(stats);
+    return mesh;
+}
+
+bool MeshCache::accepts(const Mesh& mesh) const
+{
+    // Entries hold the plain indexed mesh, so that it can be chunked and
+    // quantized (or not) whenever it's loaded.
+    if (entry_path.isEmpty() || !mesh.stats() || !mesh.indexed() || mesh.quantized() || !mesh.chunks().empty()) {
+        return false;
+    }
+
+    // Skip meshes that could never fit in the cache
+    const qint64 size = sizeof(CacheHeader) + mesh.vertexFloats() * sizeof(GLfloat) + mesh.indices.size() * sizeof(GLuint);
+    return size <= budget;
+}
+
+void MeshCache::store(const Mesh& mesh) const
+{
+    if (!accepts(mesh)) {
+        return;
+    }
+    const MeshStats* stats = mesh.stats();
+
+    QDir().mkpath(QFileInfo(entry_path).absolutePath());
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.vertex_floats = mesh.vertexFloats();
+    header.index_count = mesh.indices.size();
+    for (int axis = 0; axis < 3; ++axis) {
+        header.lower[axis] = stats->lower[axis];
+        header.upper[axis] = stats->upper[axis];
+        header.centroid[axis] = stats->centroid[axis];
+    }
+    header.area = stats->area;
+    header.volume = stats->volume;
+    header.edge_min = stats->edge_min;
+    header.edge_max = stats->edge_max;
+    header.edge_mean = stats->edge_mean;
+    header.edge_stddev = stats->edge_stddev;
+
+    // QSaveFile writes to a temporary file and renames it into place, so
+    // a concurrent load never sees a partially written entry.
+    QSaveFile entry(entry_path);
+    if (!entry.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    entry.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (mesh.soup_index.empty()) {
+        entry.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(GLfloat));
+    } else {
+        // Meshes welded straight from a soup are gathered out of it a
+        // batch at a time, rather than being flattened in memory first
+        const size_t BATCH = 1 << 16;
+        std::vector<Vertex> batch;
+        batch.reserve(BATCH);
+        for (size_t start = 0; start < mesh.soup_index.size(); start += BATCH) {
+            batch.clear();
+            const size_t end = std::min(start + BATCH, mesh.soup_index.size());
+            for (size_t v = start; v < end; ++v) {
+                batch.push_back(mesh.soup[mesh.soup_index[v]]);
+            }
+            entry.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(Vertex));
+        }
+    }
+    entry.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(GLuint));
+    if (entry.commit()) {
+        evict();
+    }
+}
+
+void MeshCache::evict() const
+{
+    // Entries are touched when used, so the oldest modification times
+    // belong to the least recently used entries.
+    QDir dir(QFileInfo(entry_path).absolutePath());
+    const auto entries = dir.entryInfoList(QStringList() << "*.mesh", QDir::Files, QDir::Time);
+
+    qint64 total = 0;
+    for (const auto& e : entries) {
+        total += e.size();
+        if (total > budget) {
+            QFile::remove(e.absoluteFilePath());
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <QString>
+
+class Mesh;
+class QFile;
+struct FileSnapshot;
+
+/*
+ *  On-disk cache of welded meshes, so that reopening a file skips parsing
+ *  and deduplication entirely.
+ *
+ *  Entries live in the user's cache directory, named by a hash of the
+ *  file's contents (leaving out a binary file's header), so renamed or
+ *  copied files still hit and a file rewritten in place never does.
+ *  Each entry is a fixed header followed by the raw vertex and index
+ *  arrays, so it can be mapped and copied straight into a Mesh.  The
+ *  total size of the cache is bounded, and the least recently used
+ *  entries are evicted first.
+ */
+class MeshCache
+{
+public:
+    /*  Looks up the entry for an open file, given the block hashes of its
+     *  whole contents.  Qt resources and files that can't be read are
+     *  never cached. */
+    MeshCache(QFile& file, const FileSnapshot& contents);
+
+    /*  Returns the cached mesh, or NULL if there isn't a valid entry */
+    Mesh* load() const;
+
+    /*  Checks whether store would write an entry for the mesh */
+    bool accepts(const Mesh& mesh) const;
+    /*  Writes the mesh to the cache, then evicts old entries as needed */
+    void store(const Mesh& mesh) const;
+
+    const static QString CACHE_SIZE_KEY;
+
+private:
+    void evict() const;
+
+    QString entry_path;
+    qint64 budget;
+};
+
+#endif // MESHCACHE_H
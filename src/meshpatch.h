@@ -0,0 +1,57 @@
+#ifndef MESHPATCH_H
+#define MESHPATCH_H
+
+#include <QSharedPointer>
+#include <QVector>
+
+#include <vector>
+
+#include "mesh.h"
+
+/*
+ *  What a load leaves behind for the next reload of the same file, so
+ *  that the reload can skip an unchanged file or patch a changed one in
+ *  place.
+ *
+ *  The file is hashed in blocks of BLOCK_TRIANGLES triangles (or of as
+ *  many bytes, for ASCII files), leaving out a binary file's header.  For
+ *  binary files, the snapshot can also record which slot of the uploaded
+ *  vertex buffer each triangle corner of the file ended up in.
+ */
+struct FileSnapshot {
+    qint64 size = 0;
+    bool binary = false;
+    QVector<quint64> hashes;
+
+    /*  Vertex buffer slot of each triangle corner, in file order, or NULL
+     *  if the mesh can't be patched.  Patching keeps the slots, so it's
+     *  shared with the snapshots of later reloads. */
+    QSharedPointer<const std::vector<GLuint>> corner_slots;
+    GLuint slot_count = 0;
+
+    /*  Quantized vertex buffers can only hold positions within the
+     *  bounds of the mesh they were made from */
+    bool quantized = false;
+    QVector3D lower, upper;
+
+    /*  Serial of the canvas part's mesh that this snapshot describes, which
+     *  is filled in once the snapshot reaches the GUI thread */
+    quint64 serial = 0;
+
+    const static size_t BLOCK_TRIANGLES = 4096;
+};
+
+/*  New positions for some of the slots of a loaded mesh's vertex buffer,
+ *  along with the patched mesh's statistics */
+struct MeshPatch {
+    /*  In ascending order, with xyz positions to match */
+    std::vector<GLuint> slots;
+    std::vector<GLfloat> positions;
+    MeshStats stats;
+
+    /*  Serial of the canvas part's mesh that the slots refer to; the
+     *  patch is rejected if the part has been given another mesh since */
+    quint64 serial = 0;
+};
+
+#endif // MESHPATCH_H
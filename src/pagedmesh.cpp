@@ -0,0 +1,52 @@
+#include "pagedmesh.h"
+
+PagedMesh::PagedMesh(QFile* file, std::vector<Page>&& pages, std::vector<Mesh*>&& overview, const MeshStats& stats) :
+    file(file), page_list(std::move(pages)), overview(std::move(overview)), mesh_stats(stats)
+{
+    // Nothing to do here
+}
+
+PagedMesh::~PagedMesh()
+{
+    for (const auto m : overview) {
+        delete m;
+    }
+    delete file;
+}
+
+const std::vector<PagedMesh::Page>& PagedMesh::pages() const
+{
+    return page_list;
+}
+
+const MeshStats& PagedMesh::stats() const
+{
+    return mesh_stats;
+}
+
+qint64 PagedMesh::triCount() const
+{
+    qint64 count = 0;
+    for (const auto& page : page_list) {
+        count += page.tri_count;
+    }
+    return count;
+}
+
+bool PagedMesh::readPage(size_t i, Soup& verts) const
+{
+    const Page& page = page_list[i];
+    if (!file->seek(page.offset)) {
+        return false;
+    }
+    verts.resize(page.tri_count * 3);
+    const qint64 bytes = verts.size() * sizeof(Vertex);
+    return file->read(reinterpret_cast<char*>(verts.data()), bytes) == bytes;
+}
+
+Mesh* PagedMesh::takeOverview(size_t i)
+{
+    Mesh* m = overview[i];
+    overview[i] = nullptr;
+    return m;
+}
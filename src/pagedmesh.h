@@ -0,0 +1,53 @@
+#ifndef PAGEDMESH_H
+#define PAGEDMESH_H
+
+#include <QFile>
+
+#include <vector>
+
+#include "mesh.h"
+#include "vertex.h"
+
+/*
+ *  A mesh too big to hold in memory, which the loader splits into pages
+ *  of nearby triangles in a file on disk.
+ *
+ *  The page file starts with a header and a table of every page's bounds
+ *  and location, followed by each page's triangles as a raw triangle
+ *  soup.  Only a coarse overview of each page is kept in memory, and the
+ *  full pages are read back on demand as they come into view.
+ */
+class PagedMesh
+{
+public:
+    struct Page {
+        float lower[3], upper[3];
+        quint64 offset;
+        quint64 tri_count;
+    };
+
+    /*  Takes ownership of the open page file (which should remove itself
+     *  once closed) and the overview meshes (one per page, any of which
+     *  may be NULL) */
+    PagedMesh(QFile* file, std::vector<Page>&& pages, std::vector<Mesh*>&& overview, const MeshStats& stats);
+    ~PagedMesh();
+
+    const std::vector<Page>& pages() const;
+    const MeshStats& stats() const;
+    qint64 triCount() const;
+
+    /*  Reads a page's triangles as a triangle soup, returning false if
+     *  the page file couldn't be read */
+    bool readPage(size_t i, Soup& verts) const;
+
+    /*  Hands over a page's overview mesh, which the caller then owns */
+    Mesh* takeOverview(size_t i);
+
+private:
+    QFile* const file;
+    const std::vector<Page> page_list;
+    std::vector<Mesh*> overview;
+    const MeshStats mesh_stats;
+};
+
+#endif // PAGEDMESH_H
@@ -0,0 +1,174 @@
+#include <QFileInfo>
+
+#include <limits>
+
+#include "mesh.h"
+#include "prefetcher.h"
+
+Prefetcher::Prefetcher(QObject* parent) : QObject(parent), quantize(quantize_auto), building(nullptr)
+{
+    set_budget(qint64(1) << 30);
+}
+
+Prefetcher::~Prefetcher()
+{
+    if (loader) {
+        loader->requestInterruption();
+        loader->wait();
+    }
+    delete building;
+}
+
+Prefetcher::Entry::~Entry()
+{
+    delete mesh;
+    qDeleteAll(lods);
+}
+
+void Prefetcher::set_budget(qint64 bytes)
+{
+    cache.setMaxCost(int(std::min<qint64>(bytes >> 10, std::numeric_limits<int>::max())));
+}
+
+void Prefetcher::prefetch(const QStringList& filenames, QuantizeMode mode)
+{
+    // Meshes decoded with another quantize mode are laid out differently
+    if (mode != quantize) {
+        cache.clear();
+        quantize = mode;
+    }
+
+    // Stop decoding a file that's no longer wanted, which is what happens
+    // to the files ahead when the direction of travel changes
+    if (loader && !filenames.contains(current_file)) {
+        loader->requestInterruption();
+        loader = nullptr;
+        delete building;
+        building = nullptr;
+    }
+
+    queue.clear();
+    for (const auto& f : filenames) {
+        if (!cache.contains(f) && !(loader && f == current_file)) {
+            queue.append(f);
+        }
+    }
+    start_next();
+}
+
+bool Prefetcher::decoding(const QString& filename) const
+{
+    return loader && filename == current_file;
+}
+
+void Prefetcher::drop(const QString& filename)
+{
+    queue.removeAll(filename);
+}
+
+bool Prefetcher::fetch(const QString& filename, Mesh*& mesh, QVector<Mesh*>& lods, LoadProfile& profile)
+{
+    // Copying a big mesh would stall the GUI thread, so the entry is
+    // handed over instead.  Once the user steps on, this file is one of
+    // the neighbors and gets prefetched again.
+    Entry* entry = cache.take(filename);
+    if (!entry) {
+        return false;
+    } else if (QFileInfo(filename).lastModified() != entry->modified) {
+        delete entry;
+        return false;
+    }
+
+    mesh = entry->mesh;
+    lods = entry->lods;
+    profile = entry->profile;
+    entry->mesh = nullptr;
+    entry->lods.clear();
+    delete entry;
+    return true;
+}
+
+void Prefetcher::start_next()
+{
+    if (loader || queue.isEmpty()) {
+        return;
+    }
+
+    current_file = queue.takeFirst();
+    building = new Entry;
+    building->modified = QFileInfo(current_file).lastModified();
+
+    // Prefetches shouldn't slow down the file that's being looked at, so
+    // they run at a low priority on half of the cores
+    loader = new Loader(this, current_file, false, quantize);
+    loader->set_prefetch(true);
+    loader->set_worker_threads(std::max(QThread::idealThreadCount() / 2, 1));
+    connect(loader, &Loader::got_mesh, this, &Prefetcher::on_got_mesh);
+    connect(loader, &Loader::got_lod, this, &Prefetcher::on_got_lod);
+    connect(loader, &Loader::error_bad_stl, this, &Prefetcher::on_error);
+    connect(loader, &Loader::error_empty_mesh, this, &Prefetcher::on_error);
+    connect(loader, &Loader::error_missing_file, this, &Prefetcher::on_error);
+
+    connect(loader, &Loader::finished, loader, &Loader::deleteLater);
+    connect(loader, &Loader::finished, this, &Prefetcher::on_finished);
+    loader->start(QThread::LowPriority);
+}
+
+void Prefetcher::on_got_mesh(Mesh* m, bool is_reload)
+{
+    Q_UNUSED(is_reload);
+    if (sender() == loader.data()) {
+        delete building->mesh;
+        building->mesh = m;
+    } else {
+        delete m;
+    }
+}
+
+void Prefetcher::on_got_lod(Mesh* m, int level)
+{
+    Q_UNUSED(level);
+    if (sender() == loader.data()) {
+        building->lods.push_back(m);
+    } else {
+        delete m;
+    }
+}
+
+void Prefetcher::on_error()
+{
+    if (sender() == loader.data()) {
+        building->failed = true;
+    }
+}
+
+void Prefetcher::on_finished()
+{
+    if (sender() != loader.data()) {
+        return;
+    }
+
+    Entry* entry = building;
+    const QString filename = current_file;
+    building = nullptr;
+    loader = nullptr;
+
+    if (entry->failed || !entry->mesh) {
+        delete entry;
+        emit failed(filename);
+    } else {
+        entry->profile = static_cast<Loader*>(sender())->load_profile();
+        qint64 bytes = entry->mesh->vertexBufferSize() + entry->mesh->indexBufferSize();
+        for (const auto lod : entry->lods) {
+            bytes += lod->vertexBufferSize() + lod->indexBufferSize();
+        }
+
+        // Entries over the whole budget are dropped (and deleted) by insert
+        if (cache.insert(filename, entry, int(std::max<qint64>(bytes >> 10, 1)))) {
+            emit ready(filename);
+        } else {
+            emit failed(filename);
+        }
+    }
+    start_next();
+}
@@ -0,0 +1,79 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <QCache>
+#include <QDateTime>
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+
+#include "loader.h"
+#include "loadprofile.h"
+
+class Mesh;
+
+/*
+ *  Decodes files that are likely to be opened next in the background,
+ *  one at a time, and keeps the results in a memory-budgeted LRU cache,
+ *  so that opening one of them only has to upload it to the GPU.
+ */
+class Prefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Prefetcher(QObject* parent);
+    ~Prefetcher();
+
+    /*  Limits how much memory the decoded meshes may take up */
+    void set_budget(qint64 bytes);
+
+    /*  Decodes the given files, nearest first.  Any file being decoded
+     *  that's no longer wanted is cancelled. */
+    void prefetch(const QStringList& filenames, QuantizeMode quantize);
+
+    /*  Checks whether a file is being decoded right now */
+    bool decoding(const QString& filename) const;
+    /*  Takes a file off the queue, if it's waiting there */
+    void drop(const QString& filename);
+
+    /*  Moves a decoded file's mesh and levels of detail out of the cache
+     *  (the caller takes ownership of them), returning false if the file
+     *  hasn't been decoded or has changed since */
+    bool fetch(const QString& filename, Mesh*& mesh, QVector<Mesh*>& lods, LoadProfile& profile);
+
+signals:
+    /*  Emitted once a file has been decoded and cached */
+    void ready(const QString& filename);
+    /*  Emitted if a file couldn't be decoded */
+    void failed(const QString& filename);
+
+private slots:
+    void on_got_mesh(Mesh* m, bool is_reload);
+    void on_got_lod(Mesh* m, int level);
+    void on_error();
+    void on_finished();
+
+private:
+    void start_next();
+
+    struct Entry {
+        ~Entry();
+
+        Mesh* mesh = nullptr;
+        QVector<Mesh*> lods;
+        LoadProfile profile;
+        QDateTime modified;
+        bool failed = false;
+    };
+
+    /*  Entries cost their size in kilobytes */
+    QCache<QString, Entry> cache;
+    QuantizeMode quantize;
+
+    QStringList queue;
+    QString current_file;
+    QPointer<Loader> loader;
+    Entry* building;
+};
+
+#endif // PREFETCHER_H
@@ -0,0 +1,109 @@
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSettings>
+
+#include "singleinstance.h"
+
+const QString SingleInstance::SINGLE_INSTANCE_KEY = "singleInstance";
+
+SingleInstance::SingleInstance(QObject* parent) : QObject(parent), server(nullptr)
+{
+    // Nothing to do here
+}
+
+bool SingleInstance::enabled()
+{
+    return QSettings().value(SINGLE_INSTANCE_KEY, false).toBool();
+}
+
+QString SingleInstance::server_name()
+{
+    // Each user gets their own instance
+    const QByteArray home = QDir::homePath().toUtf8();
+    return "fstl-" + QCryptographicHash::hash(home, QCryptographicHash::Sha1).toHex().left(16);
+}
+
+bool SingleInstance::forward(const QStringList& args)
+{
+    QLocalSocket socket;
+    socket.connectToServer(server_name());
+    if (!socket.waitForConnected(CONNECT_MS)) {
+        return false;
+    }
+
+    QDataStream out(&socket);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << QDir::currentPath() << args;
+    socket.flush();
+
+    // The running instance answers once it has taken the arguments.  If
+    // it doesn't, it may be stuck, so this one starts up by itself.
+    if (socket.bytesToWrite() && !socket.waitForBytesWritten(REPLY_MS)) {
+        return false;
+    }
+    return socket.waitForReadyRead(REPLY_MS) && socket.read(1) == "1";
+}
+
+bool SingleInstance::listen()
+{
+    if (server) {
+        return true;
+    }
+
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    if (!server->listen(server_name())) {
+        // The name may be left over from an instance that crashed, which
+        // is cleared away unless that instance is still answering
+        QLocalSocket probe;
+        probe.connectToServer(server_name());
+        const bool running = probe.waitForConnected(CONNECT_MS);
+        if (!running) {
+            QLocalServer::removeServer(server_name());
+        }
+        if (running || !server->listen(server_name())) {
+            delete server;
+            server = nullptr;
+            return false;
+        }
+    }
+    connect(server, &QLocalServer::newConnection, this, &SingleInstance::on_connection);
+    return true;
+}
+
+void SingleInstance::close()
+{
+    delete server;
+    server = nullptr;
+}
+
+void SingleInstance::on_connection()
+{
+    while (QLocalSocket* socket = server->nextPendingConnection()) {
+        connect(socket, &QLocalSocket::readyRead, this, [=]() { read(socket); });
+        connect(socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater);
+    }
+}
+
+void SingleInstance::read(QLocalSocket* socket)
+{
+    // The message may arrive in pieces, so it's read in a transaction
+    // that's rolled back until all of it is there
+    QDataStream in(socket);
+    in.setVersion(QDataStream::Qt_5_0);
+    in.startTransaction();
+    QString dir;
+    QStringList args;
+    in >> dir >> args;
+    if (!in.commitTransaction()) {
+        return;
+    }
+
+    socket->write("1");
+    socket->flush();
+    socket->disconnectFromServer();
+    emit received(args, dir);
+}
@@ -0,0 +1,59 @@
+#ifndef SINGLEINSTANCE_H
+#define SINGLEINSTANCE_H
+
+#include <QObject>
+#include <QStringList>
+
+class QLocalServer;
+class QLocalSocket;
+
+/*
+ *  Lets a running fstl open the files of later invocations, so that
+ *  opening a file from the file manager doesn't pay for starting up a
+ *  whole new window.
+ *
+ *  The running instance listens on a local socket named for the user.
+ *  Later invocations send it their arguments, along with their working
+ *  directory, and exit once it acknowledges them.
+ */
+class SingleInstance : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SingleInstance(QObject* parent);
+
+    /*  Checks the setting for single-instance mode */
+    static bool enabled();
+
+    /*  Hands the arguments to a running instance, returning false if
+     *  there isn't one (or it doesn't answer in time) */
+    static bool forward(const QStringList& args);
+
+    /*  Starts or stops taking arguments from later invocations.  This
+     *  returns false if another instance is already listening. */
+    bool listen();
+    void close();
+
+    const static QString SINGLE_INSTANCE_KEY;
+
+signals:
+    /*  Emitted with the arguments of a later invocation, minus the
+     *  program name, and the directory it was run from */
+    void received(const QStringList& args, const QString& dir);
+
+private slots:
+    void on_connection();
+
+private:
+    void read(QLocalSocket* socket);
+    static QString server_name();
+
+    QLocalServer* server;
+
+    /*  How long a new invocation waits for the running one, after which
+     *  it starts up by itself */
+    const static int CONNECT_MS = 200;
+    const static int REPLY_MS = 2000;
+};
+
+#endif // SINGLEINSTANCE_H
@@ -0,0 +1,373 @@
+#include <QCommandLineParser>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+#include "glmesh.h"
+#include "loader.h"
+
+#ifdef FSTL_EGL
+#    include <EGL/egl.h>
+#    include <EGL/eglext.h>
+#    ifndef EGL_PLATFORM_SURFACELESS_MESA
+#        define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#    endif
+#endif
+
+/*
+ *  Headless thumbnailer for file managers, following the freedesktop.org
+ *  thumbnail spec:  each input stl is rendered with fstl's default shader
+ *  and camera to a PNG of the requested size.  Big files are previewed
+ *  from an evenly spread sample of their triangles, so that thumbnailing
+ *  takes about the same time no matter how large the file is.
+ */
+
+namespace
+{
+/*  Triangles beyond this are sampled rather than read */
+const size_t MAX_TRIANGLES = 1 << 19;
+
+/*  The same starting view as Canvas::resetTransform, fitted to the mesh's
+ *  bounding box */
+QMatrix4x4 transform_matrix(const Mesh& mesh)
+{
+    const QVector3D lower(mesh.xmin(), mesh.ymin(), mesh.zmin());
+    const QVector3D upper(mesh.xmax(), mesh.ymax(), mesh.zmax());
+    QMatrix4x4 transform;
+    transform.rotate(-90.0, QVector3D(1, 0, 0));
+    transform.rotate(180.0 + 15.0, QVector3D(0, 0, 1));
+    transform.rotate(15.0, QVector3D(1, -sin(M_PI / 12), 0));
+    transform.scale(2 / std::max((upper - lower).length(), 1e-6f));
+    transform.translate(-(lower + upper) / 2);
+    return transform;
+}
+
+QMatrix4x4 view_matrix()
+{
+    QMatrix4x4 view;
+    view.scale(-1, 1, 0.5);
+    view(3, 2) = 0.25;
+    return view;
+}
+
+bool render(QOpenGLShaderProgram& shader, const Mesh& mesh, int size, const QString& output)
+{
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::Depth);
+    format.setSamples(4);
+    QOpenGLFramebufferObject fbo(size, size, format);
+    if (!fbo.bind()) {
+        return false;
+    }
+
+    QOpenGLFunctions* gl = QOpenGLContext::currentContext()->functions();
+    gl->glViewport(0, 0, size, size);
+    gl->glEnable(GL_DEPTH_TEST);
+    gl->glClearColor(0.0, 0.0, 0.0, 0.0);
+    gl->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    const QMatrix4x4 transform = transform_matrix(mesh);
+    const QMatrix4x4 view = view_matrix();
+    GLMesh gl_mesh(&mesh);
+    shader.bind();
+    shader.setUniformValue("transform_matrix", transform);
+    shader.setUniformValue("view_matrix", view);
+    shader.setUniformValue("zoom", 1.0f);
+    shader.setUniformValue("position_offset", gl_mesh.position_offset());
+    shader.setUniformValue("position_scale", gl_mesh.position_scale());
+
+    const GLuint vp = shader.attributeLocation("vertex_position");
+    gl->glEnableVertexAttribArray(vp);
+    gl_mesh.draw(vp, view * transform);
+    gl->glDisableVertexAttribArray(vp);
+    shader.release();
+
+    fbo.release();
+    return fbo.toImage().save(output, "PNG");
+}
+
+#ifdef FSTL_EGL
+/*  Renders on Mesa's surfaceless EGL platform, which needs neither a
+ *  display server nor a GPU (using llvmpipe when there isn't one).  Qt
+ *  can't wrap a context like this, so drawing goes through plain GL on a
+ *  multisampled pbuffer of the thumbnail's size, with the triangle soup
+ *  read straight from client memory. */
+class EglRenderer
+{
+public:
+    explicit EglRenderer(int size) :
+        size(size), display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT), program(0)
+    {
+        const char* const extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        const auto get_platform_display =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (!extensions || !strstr(extensions, "EGL_MESA_platform_surfaceless") || !get_platform_display) {
+            return;
+        }
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+            display = EGL_NO_DISPLAY;
+            return;
+        }
+
+        // Multisampling is nice to have, but not worth failing over
+        EGLint attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8,
+                            EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_SAMPLE_BUFFERS, 1, EGL_SAMPLES, 4, EGL_NONE};
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(display, attribs, &config, 1, &configs) || !configs) {
+            attribs[14] = EGL_NONE;
+            if (!eglChooseConfig(display, attribs, &config, 1, &configs) || !configs) {
+                return;
+            }
+        }
+
+        const EGLint pbuffer[] = {EGL_WIDTH, size, EGL_HEIGHT, size, EGL_NONE};
+        surface = eglCreatePbufferSurface(display, config, pbuffer);
+        if (surface == EGL_NO_SURFACE || !eglBindAPI(EGL_OPENGL_API)) {
+            return;
+        }
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context) || !resolve()) {
+            return;
+        }
+        program = link();
+    }
+
+    ~EglRenderer()
+    {
+        if (display != EGL_NO_DISPLAY) {
+            if (program) {
+                glDeleteProgram(program);
+            }
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (context != EGL_NO_CONTEXT) {
+                eglDestroyContext(display, context);
+            }
+            if (surface != EGL_NO_SURFACE) {
+                eglDestroySurface(display, surface);
+            }
+            eglTerminate(display);
+        }
+    }
+
+    bool valid() const
+    {
+        return program != 0;
+    }
+
+    bool render(const Mesh& mesh, const QString& output)
+    {
+        glViewport(0, 0, size, size);
+        glEnable(GL_DEPTH_TEST);
+        glClearColor(0.0, 0.0, 0.0, 0.0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "transform_matrix"), 1, GL_FALSE, transform_matrix(mesh).constData());
+        glUniformMatrix4fv(glGetUniformLocation(program, "view_matrix"), 1, GL_FALSE, view_matrix().constData());
+        glUniform1f(glGetUniformLocation(program, "zoom"), 1.0f);
+        glUniform3f(glGetUniformLocation(program, "position_offset"), 0, 0, 0);
+        glUniform3f(glGetUniformLocation(program, "position_scale"), 1, 1, 1);
+
+        // Sampled previews are always unindexed float triangle soups
+        const GLuint vp = glGetAttribLocation(program, "vertex_position");
+        glEnableVertexAttribArray(vp);
+        glVertexAttribPointer(vp, 3, GL_FLOAT, GL_FALSE, 0, mesh.vertexData());
+        glDrawArrays(GL_TRIANGLES, 0, mesh.triCount() * 3);
+        glDisableVertexAttribArray(vp);
+        glUseProgram(0);
+
+        // Rows come back bottom to top
+        QImage image(size, size, QImage::Format_RGBA8888);
+        glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, image.bits());
+        return glGetError() == GL_NO_ERROR && image.mirrored().save(output, "PNG");
+    }
+
+private:
+    /*  Looks up the entry points beyond OpenGL 1.1 */
+    bool resolve()
+    {
+        bool okay = true;
+        auto get = [&okay](auto& f, const char* name) {
+            f = reinterpret_cast<std::remove_reference_t<decltype(f)>>(eglGetProcAddress(name));
+            okay &= f != nullptr;
+        };
+        get(glCreateShader, "glCreateShader");
+        get(glShaderSource, "glShaderSource");
+        get(glCompileShader, "glCompileShader");
+        get(glDeleteShader, "glDeleteShader");
+        get(glCreateProgram, "glCreateProgram");
+        get(glAttachShader, "glAttachShader");
+        get(glLinkProgram, "glLinkProgram");
+        get(glGetProgramiv, "glGetProgramiv");
+        get(glDeleteProgram, "glDeleteProgram");
+        get(glUseProgram, "glUseProgram");
+        get(glGetUniformLocation, "glGetUniformLocation");
+        get(glGetAttribLocation, "glGetAttribLocation");
+        get(glUniformMatrix4fv, "glUniformMatrix4fv");
+        get(glUniform1f, "glUniform1f");
+        get(glUniform3f, "glUniform3f");
+        get(glVertexAttribPointer, "glVertexAttribPointer");
+        get(glEnableVertexAttribArray, "glEnableVertexAttribArray");
+        get(glDisableVertexAttribArray, "glDisableVertexAttribArray");
+        return okay;
+    }
+
+    /*  Builds the same program as the Qt path, returning 0 on failure */
+    GLuint link()
+    {
+        const GLuint prog = glCreateProgram();
+        const auto sources = {qMakePair(GLenum(GL_VERTEX_SHADER), ":/gl/mesh.vert"), qMakePair(GLenum(GL_FRAGMENT_SHADER), ":/gl/mesh.frag")};
+        for (const auto& s : sources) {
+            QFile file(s.second);
+            file.open(QIODevice::ReadOnly);
+            const QByteArray source = file.readAll();
+            const char* const text = source.constData();
+            const GLuint shader = glCreateShader(s.first);
+            glShaderSource(shader, 1, &text, nullptr);
+            glCompileShader(shader);
+            glAttachShader(prog, shader);
+            glDeleteShader(shader);
+        }
+        glLinkProgram(prog);
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            glDeleteProgram(prog);
+            return 0;
+        }
+        return prog;
+    }
+
+    const int size;
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+    GLuint program;
+
+    PFNGLCREATESHADERPROC glCreateShader;
+    PFNGLSHADERSOURCEPROC glShaderSource;
+    PFNGLCOMPILESHADERPROC glCompileShader;
+    PFNGLDELETESHADERPROC glDeleteShader;
+    PFNGLCREATEPROGRAMPROC glCreateProgram;
+    PFNGLATTACHSHADERPROC glAttachShader;
+    PFNGLLINKPROGRAMPROC glLinkProgram;
+    PFNGLGETPROGRAMIVPROC glGetProgramiv;
+    PFNGLDELETEPROGRAMPROC glDeleteProgram;
+    PFNGLUSEPROGRAMPROC glUseProgram;
+    PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
+    PFNGLGETATTRIBLOCATIONPROC glGetAttribLocation;
+    PFNGLUNIFORMMATRIX4FVPROC glUniformMatrix4fv;
+    PFNGLUNIFORM1FPROC glUniform1f;
+    PFNGLUNIFORM3FPROC glUniform3f;
+    PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer;
+    PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
+    PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray;
+};
+#endif
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    // Thumbnailers run without a display, so default to Qt's offscreen
+    // platform.  That only gets an OpenGL context through GLX (and so an
+    // X server), which is why it's just the fallback for surfaceless EGL.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("fstl-app");
+    QCoreApplication::setApplicationName("fstl-thumbnailer");
+    QCoreApplication::setApplicationVersion(FSTL_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders thumbnails of STL files for file managers.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("input", "STL file to preview.");
+    parser.addPositionalArgument("output", "PNG file to write (more input and output pairs may follow).");
+    const QCommandLineOption size("s", "Render thumbnails of <size> by <size> pixels (default 256).", "size", "256");
+    const QCommandLineOption budget("t", "Spend at most about <ms> milliseconds reading each file (default 400).", "ms", "400");
+    parser.addOptions({size, budget});
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.isEmpty() || args.size() % 2) {
+        parser.showHelp(1);
+    }
+    const int pixels = std::max(parser.value(size).toInt(), 1);
+    const qint64 budget_ms = parser.value(budget).toLongLong();
+
+    // Files are read in parallel, since that's where the time goes, and
+    // rendered one after another on this thread's context
+    std::vector<std::future<std::unique_ptr<Mesh>>> meshes;
+    for (int i = 0; i < args.size(); i += 2) {
+        const QString input = args[i];
+        meshes.push_back(std::async(std::launch::async, [input, budget_ms]() {
+            Loader loader(nullptr, input, true);
+            QSharedPointer<Soup> verts(new Soup);
+            return std::unique_ptr<Mesh>(loader.sample_stl(*verts, MAX_TRIANGLES, budget_ms) ? new Mesh(verts) : nullptr);
+        }));
+    }
+
+    std::function<bool(const Mesh&, const QString&)> draw;
+#ifdef FSTL_EGL
+    EglRenderer egl(pixels);
+    if (egl.valid()) {
+        draw = [&egl](const Mesh& mesh, const QString& output) { return egl.render(mesh, output); };
+    }
+#endif
+
+    QSurfaceFormat format;
+    format.setVersion(2, 1);
+    format.setProfile(QSurfaceFormat::NoProfile);
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    QOpenGLShaderProgram shader;
+    if (!draw) {
+        context.setFormat(format);
+        surface.setFormat(format);
+        surface.create();
+        if (!context.create() || !context.makeCurrent(&surface)) {
+            qCritical("Could not create an OpenGL context");
+            return 1;
+        }
+
+        shader.addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/gl/mesh.vert");
+        shader.addCacheableShaderFromSourceFile(QOpenGLShader::Fragment, ":/gl/mesh.frag");
+        if (!shader.link()) {
+            qCritical("Could not link the mesh shader");
+            return 1;
+        }
+        draw = [&shader, pixels](const Mesh& mesh, const QString& output) { return render(shader, mesh, pixels, output); };
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const QString& input = args[2 * i];
+        const QString& output = args[2 * i + 1];
+        const auto mesh = meshes[i].get();
+        if (!mesh || mesh->empty()) {
+            qCritical("Could not read %s", qPrintable(input));
+            status = 1;
+        } else if (!draw(*mesh, output)) {
+            qCritical("Could not write %s", qPrintable(output));
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,76 @@
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+#include "glmesh.h"
+#include "mesh.h"
+#include "pagedmesh.h"
+#include "uploader.h"
+
+Uploader::Uploader(QOpenGLContext* share, QObject* parent) :
+    QObject(parent), worker(new QObject), context(new QOpenGLContext), surface(new QOffscreenSurface)
+{
+    context->setFormat(share->format());
+    context->setShareContext(share);
+    context->create();
+
+    // Surfaces have to be created on the GUI thread, but the context
+    // lives on the upload thread from here on
+    surface->setFormat(context->format());
+    surface->create();
+    context->moveToThread(&thread);
+    worker->moveToThread(&thread);
+
+    connect(this, &Uploader::queued, worker, [this](Mesh* m, quint64 tag) {
+        GLMesh* mesh = upload_now(m);
+        delete m;
+        emit uploaded(mesh, tag);
+    });
+    thread.start(QThread::LowPriority);
+}
+
+GLMesh* Uploader::upload_now(const Mesh* m)
+{
+    context->makeCurrent(surface);
+    GLMesh* mesh = new GLMesh(m);
+
+    // OpenGL 2.1 has no fences, so the upload thread waits for its own
+    // commands to finish before the buffers are handed over
+    context->functions()->glFinish();
+    context->doneCurrent();
+    return mesh;
+}
+
+Uploader::~Uploader()
+{
+    thread.quit();
+    thread.wait();
+    delete worker;
+    delete context;
+    delete surface;
+}
+
+bool Uploader::valid() const
+{
+    return context->isValid() && surface->isValid() && context->shareContext();
+}
+
+void Uploader::upload(Mesh* m, quint64 tag)
+{
+    emit queued(m, tag);
+}
+
+void Uploader::upload_page(const QSharedPointer<PagedMesh>& source, size_t page, quint64 tag)
+{
+    // Pages are read on the upload thread too, so that a cold read never
+    // stalls a frame
+    QMetaObject::invokeMethod(worker, [this, source, page, tag]() {
+        QSharedPointer<Soup> verts(new Soup);
+        if (!source->readPage(page, *verts)) {
+            emit uploaded(nullptr, tag);
+            return;
+        }
+        const Mesh m(verts);
+        emit uploaded(upload_now(&m), tag);
+    });
+}
@@ -0,0 +1,58 @@
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QThread>
+
+class GLMesh;
+class Mesh;
+class PagedMesh;
+class QOffscreenSurface;
+class QOpenGLContext;
+
+/*
+ *  Uploads meshes to the GPU on a thread of its own, through a context
+ *  that shares objects with the canvas's context, so that the window
+ *  stays responsive while big meshes are copied over.
+ */
+class Uploader : public QObject
+{
+    Q_OBJECT
+public:
+    /*  Creates the upload context, which shares with the given context.
+     *  This has to be called on the GUI thread. */
+    Uploader(QOpenGLContext* share, QObject* parent);
+    ~Uploader();
+
+    /*  Whether the upload context could be created */
+    bool valid() const;
+
+    /*  Queues a mesh for upload, taking ownership of it.  Meshes are
+     *  uploaded in the order they were queued, and tag is passed back
+     *  untouched with the result. */
+    void upload(Mesh* m, quint64 tag);
+    /*  Queues a page of a paged mesh to be read from disk and uploaded,
+     *  keeping the paged mesh alive until then */
+    void upload_page(const QSharedPointer<PagedMesh>& source, size_t page, quint64 tag);
+
+signals:
+    /*  Emitted once a mesh's buffers have been completely filled, so that
+     *  they're safe to draw from the shared context (or with a NULL mesh
+     *  if a page couldn't be read) */
+    void uploaded(GLMesh* mesh, quint64 tag);
+
+    /*  Hands a mesh over to the upload thread */
+    void queued(Mesh* m, quint64 tag);
+
+private:
+    /*  Uploads a mesh on the upload thread */
+    GLMesh* upload_now(const Mesh* m);
+
+    QThread thread;
+    QObject* worker;
+    QOpenGLContext* context;
+    QOffscreenSurface* surface;
+};
+
+#endif // UPLOADER_H
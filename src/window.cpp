@@ -1,19 +1,32 @@
+#include <QDockWidget>
+#include <QListWidget>
 #include <QMenuBar>
 
 #include "canvas.h"
+#include "filewatcher.h"
+#include "folderindex.h"
 #include "loader.h"
+#include "pagedmesh.h"
+#include "prefetcher.h"
 #include "shaderlightprefs.h"
+#include "singleinstance.h"
 #include "window.h"
+#include "workspace.h"
 
 const QString Window::OPEN_EXTERNAL_KEY = "externalCmd";
 const QString Window::RECENT_FILE_KEY = "recentFiles";
 const QString Window::INVERT_ZOOM_KEY = "invertZoom";
+const QString Window::ADAPTIVE_RESOLUTION_KEY = "adaptiveResolution";
+const QString Window::SUPERSAMPLE_KEY = "supersample";
 const QString Window::AUTORELOAD_KEY = "autoreload";
 const QString Window::DRAW_AXES_KEY = "drawAxes";
 const QString Window::PROJECTION_KEY = "projection";
 const QString Window::DRAW_MODE_KEY = "drawMode";
 const QString Window::WINDOW_GEOM_KEY = "windowGeometry";
 const QString Window::RESET_TRANSFORM_ON_LOAD_KEY = "resetTransformOnLoad";
+const QString Window::QUANTIZE_KEY = "quantize";
+const QString Window::PREFETCH_DEPTH_KEY = "prefetchDepth";
+const QString Window::PREFETCH_BUDGET_KEY = "prefetchBudget";
 
 Window::Window(QWidget* parent) :
     QMainWindow(parent),
@@ -38,16 +51,31 @@ Window::Window(QWidget* parent) :
     drawModePrefs_action(new QAction("Draw Mode &Settings")),
     axes_action(new QAction("Draw &Axes", this)),
     invert_zoom_action(new QAction("Invert &Zoom", this)),
+    adaptive_resolution_action(new QAction("Lower &Resolution While Moving", this)),
+    supersample_action(new QAction("Super&sample Still Frames", this)),
     reload_action(new QAction("Re&load", this)),
     autoreload_action(new QAction("&Autoreload", this)),
+    single_instance_action(new QAction("Open Files in &This Window", this)),
     save_screenshot_action(new QAction("Save &Screenshot", this)),
     hide_menuBar_action(new QAction("Hide &Menu Bar", this)),
     fullscreen_action(new QAction("Toggle &Fullscreen", this)),
     resetTransformOnLoadAction(new QAction("Reset rotation on load", this)),
+    quantize_never_action(new QAction("&Full", this)),
+    quantize_always_action(new QAction("&Quantized (16-bit)", this)),
+    quantize_auto_action(new QAction("&Automatic", this)),
     recent_files(new QMenu("Open &recent", this)),
     recent_files_group(new QActionGroup(this)),
     recent_files_clear_action(new QAction("&Clear recent files", this)),
-    watcher(new QFileSystemWatcher(this))
+    folder_files(new FolderIndex(this)),
+    folder_position(-1),
+    pending_step(0),
+    watcher(new FileWatcher(this)),
+    prefetcher(new Prefetcher(this)),
+    prefetch_depth(2),
+    next_loader(0),
+    running_loaders(0),
+    max_loaders(1),
+    loaded_parts(0)
 
 {
     setWindowTitle("fstl");
@@ -67,9 +95,20 @@ Window::Window(QWidget* parent) :
 
     meshlightprefs = new ShaderLightPrefs(this, canvas);
 
+    parts_dock = new QDockWidget("Parts", this);
+    parts_dock->setObjectName("parts");
+    parts_list = new QListWidget(parts_dock);
+    parts_dock->setWidget(parts_list);
+    addDockWidget(Qt::LeftDockWidgetArea, parts_dock);
+    parts_dock->hide();
+    QObject::connect(parts_list, &QListWidget::itemChanged, this, &Window::on_part_toggled);
+
     QObject::connect(drawModePrefs_action, &QAction::triggered, this, &Window::on_drawModePrefs);
 
-    QObject::connect(watcher, &QFileSystemWatcher::fileChanged, this, &Window::on_watched_change);
+    QObject::connect(watcher, &FileWatcher::changed, this, &Window::on_watched_change);
+    QObject::connect(prefetcher, &Prefetcher::ready, this, &Window::on_prefetched);
+    QObject::connect(prefetcher, &Prefetcher::failed, this, &Window::on_prefetch_failed);
+    QObject::connect(folder_files, &FolderIndex::indexed, this, &Window::on_folder_indexed);
 
     open_action->setShortcut(QKeySequence::Open);
     QObject::connect(open_action, &QAction::triggered, this, &Window::on_open);
@@ -88,6 +127,9 @@ Window::Window(QWidget* parent) :
     autoreload_action->setCheckable(true);
     QObject::connect(autoreload_action, &QAction::triggered, this, &Window::on_autoreload_triggered);
 
+    single_instance_action->setCheckable(true);
+    QObject::connect(single_instance_action, &QAction::triggered, this, &Window::on_single_instance_triggered);
+
     reload_action->setShortcut(QKeySequence::Refresh);
     reload_action->setEnabled(false);
     QObject::connect(reload_action, &QAction::triggered, this, &Window::on_reload);
@@ -109,6 +151,18 @@ Window::Window(QWidget* parent) :
     file_menu->addSeparator();
     file_menu->addAction(reload_action);
     file_menu->addAction(autoreload_action);
+    file_menu->addAction(single_instance_action);
+    const auto prefetch_menu = file_menu->addMenu("Pre&fetch Neighbors");
+    prefetch_depths = new QActionGroup(prefetch_menu);
+    for (int depth : {0, 1, 2, 4, 8}) {
+        const auto a = new QAction(depth ? QStringLiteral("%1 File%2 Ahead").arg(depth).arg(depth > 1 ? "s" : "") : "&Off", prefetch_menu);
+        a->setData(depth);
+        a->setCheckable(true);
+        prefetch_depths->addAction(a);
+        prefetch_menu->addAction(a);
+    }
+    prefetch_depths->setExclusive(true);
+    QObject::connect(prefetch_depths, &QActionGroup::triggered, this, &Window::on_prefetchDepth);
     file_menu->addAction(save_screenshot_action);
     file_menu->addAction(quit_action);
 
@@ -175,10 +229,28 @@ Window::Window(QWidget* parent) :
     invert_zoom_action->setCheckable(true);
     QObject::connect(invert_zoom_action, &QAction::triggered, this, &Window::on_invertZoom);
 
+    view_menu->addAction(adaptive_resolution_action);
+    adaptive_resolution_action->setCheckable(true);
+    QObject::connect(adaptive_resolution_action, &QAction::triggered, this, &Window::on_adaptiveResolution);
+
+    view_menu->addAction(supersample_action);
+    supersample_action->setCheckable(true);
+    QObject::connect(supersample_action, &QAction::triggered, this, &Window::on_supersample);
+
     view_menu->addAction(resetTransformOnLoadAction);
     resetTransformOnLoadAction->setCheckable(true);
     QObject::connect(resetTransformOnLoadAction, &QAction::triggered, this, &Window::on_resetTransformOnLoad);
 
+    const auto quantize_menu = view_menu->addMenu("Vertex &Precision");
+    const auto quantize_modes = new QActionGroup(quantize_menu);
+    for (auto p : {quantize_never_action, quantize_always_action, quantize_auto_action}) {
+        quantize_menu->addAction(p);
+        quantize_modes->addAction(p);
+        p->setCheckable(true);
+    }
+    quantize_modes->setExclusive(true);
+    QObject::connect(quantize_modes, &QActionGroup::triggered, this, &Window::on_quantize);
+
     view_menu->addAction(hide_menuBar_action);
     hide_menuBar_action->setShortcut(Qt::CTRL + Qt::SHIFT + Qt::Key_C);
     hide_menuBar_action->setCheckable(true);
@@ -191,6 +263,10 @@ Window::Window(QWidget* parent) :
     QObject::connect(fullscreen_action, &QAction::toggled, this, &Window::on_fullscreen);
     this->addAction(fullscreen_action);
 
+    const auto parts_action = parts_dock->toggleViewAction();
+    parts_action->setText("Show &Parts");
+    view_menu->addAction(parts_action);
+
     auto help_menu = menuBar()->addMenu("&Help");
     help_menu->addAction(about_action);
 
@@ -204,11 +280,21 @@ void Window::load_persist_settings()
     canvas->invert_zoom(invert_zoom);
     invert_zoom_action->setChecked(invert_zoom);
 
+    bool adaptive_resolution = settings.value(ADAPTIVE_RESOLUTION_KEY, true).toBool();
+    canvas->adaptive_resolution(adaptive_resolution);
+    adaptive_resolution_action->setChecked(adaptive_resolution);
+
+    bool supersample = settings.value(SUPERSAMPLE_KEY, false).toBool();
+    canvas->supersample(supersample);
+    supersample_action->setChecked(supersample);
+
     bool resetTransformOnLoad = settings.value(RESET_TRANSFORM_ON_LOAD_KEY, true).toBool();
     canvas->setResetTransformOnLoad(resetTransformOnLoad);
     resetTransformOnLoadAction->setChecked(resetTransformOnLoad);
 
     autoreload_action->setChecked(settings.value(AUTORELOAD_KEY, true).toBool());
+    Workspace::set_retain(autoreload_action->isChecked());
+    single_instance_action->setChecked(SingleInstance::enabled());
 
     bool draw_axes = settings.value(DRAW_AXES_KEY, false).toBool();
     canvas->draw_axes(draw_axes);
@@ -223,6 +309,21 @@ void Window::load_persist_settings()
         orthographic_action->setChecked(true);
     }
 
+    QString quantize = settings.value(QUANTIZE_KEY, "auto").toString();
+    if (quantize == "never") {
+        quantize_never_action->setChecked(true);
+    } else if (quantize == "always") {
+        quantize_always_action->setChecked(true);
+    } else {
+        quantize_auto_action->setChecked(true);
+    }
+
+    prefetch_depth = settings.value(PREFETCH_DEPTH_KEY, 2).toInt();
+    for (auto a : prefetch_depths->actions()) {
+        a->setChecked(a->data().toInt() == prefetch_depth);
+    }
+    prefetcher->set_budget(settings.value(PREFETCH_BUDGET_KEY, 1024).toLongLong() << 20);
+
     QString path = settings.value(OPEN_EXTERNAL_KEY, "").toString();
     if (!QDir::isAbsolutePath(path) && !path.isEmpty()) {
         path = QStandardPaths::findExecutable(path);
@@ -258,9 +359,9 @@ void Window::on_drawModePrefs()
 
 void Window::on_open()
 {
-    const QString filename = QFileDialog::getOpenFileName(this, "Load .stl file", QString(), "STL files (*.stl *.STL)");
-    if (!filename.isNull()) {
-        load_stl(filename);
+    const QStringList filenames = QFileDialog::getOpenFileNames(this, "Load .stl files", QString(), "STL files (*.stl *.STL)");
+    if (!filenames.isEmpty()) {
+        load_files(filenames);
     }
 }
 
@@ -299,6 +400,9 @@ void Window::on_about()
 
 void Window::on_bad_stl()
 {
+    if (!show_load_error(sender())) {
+        return;
+    }
     QMessageBox::critical(this, "Error",
                           "<b>Error:</b><br>"
                           "This <code>.stl</code> file is invalid or corrupted.<br>"
@@ -307,6 +411,9 @@ void Window::on_bad_stl()
 
 void Window::on_empty_mesh()
 {
+    if (!show_load_error(sender())) {
+        return;
+    }
     QMessageBox::critical(this, "Error",
                           "<b>Error:</b><br>"
                           "This file is syntactically correct<br>but contains no triangles.");
@@ -314,28 +421,28 @@ void Window::on_empty_mesh()
 
 void Window::on_missing_file()
 {
+    if (!show_load_error(sender())) {
+        return;
+    }
     QMessageBox::critical(this, "Error",
                           "<b>Error:</b><br>"
                           "The target file is missing.<br>");
 }
 
-void Window::enable_open()
-{
-    open_action->setEnabled(true);
-}
-
-void Window::disable_open()
+void Window::on_page_file_error()
 {
-    open_action->setEnabled(false);
+    if (!show_load_error(sender())) {
+        return;
+    }
+    QMessageBox::critical(this, "Error",
+                          "<b>Error:</b><br>"
+                          "This file is too big to load into memory,<br>"
+                          "and there isn't enough disk space to page it from disk.");
 }
 
 void Window::set_watched(const QString& filename)
 {
-    const auto files = watcher->files();
-    if (files.size()) {
-        watcher->removePaths(watcher->files());
-    }
-    watcher->addPath(filename);
+    watcher->set_path(filename);
 
     QSettings settings;
     auto recent = settings.value(RECENT_FILE_KEY).toStringList();
@@ -395,27 +502,77 @@ void Window::on_invertZoom(bool d)
     QSettings().setValue(INVERT_ZOOM_KEY, d);
 }
 
+void Window::on_adaptiveResolution(bool d)
+{
+    canvas->adaptive_resolution(d);
+    QSettings().setValue(ADAPTIVE_RESOLUTION_KEY, d);
+}
+
+void Window::on_supersample(bool d)
+{
+    canvas->supersample(d);
+    QSettings().setValue(SUPERSAMPLE_KEY, d);
+}
+
 void Window::on_resetTransformOnLoad(bool d)
 {
     canvas->setResetTransformOnLoad(d);
     QSettings().setValue(RESET_TRANSFORM_ON_LOAD_KEY, d);
 }
 
+void Window::on_quantize(QAction* mode)
+{
+    if (mode == quantize_never_action) {
+        QSettings().setValue(QUANTIZE_KEY, "never");
+    } else if (mode == quantize_always_action) {
+        QSettings().setValue(QUANTIZE_KEY, "always");
+    } else {
+        QSettings().setValue(QUANTIZE_KEY, "auto");
+    }
+
+    // The mode is applied by the loader, so reload to see it take effect
+    // (from scratch, since patching would keep the old layout)
+    snapshot.clear();
+    if (!scene_files.isEmpty()) {
+        load_files(scene_files, true);
+    }
+}
+
+void Window::on_prefetchDepth(QAction* depth)
+{
+    prefetch_depth = depth->data().toInt();
+    QSettings().setValue(PREFETCH_DEPTH_KEY, prefetch_depth);
+    if (scene_files.size() == 1) {
+        prefetch_neighbors();
+    }
+}
+
 void Window::on_watched_change(const QString& filename)
 {
-    if (autoreload_action->isChecked()) {
+    // Only single-file scenes are watched
+    if (autoreload_action->isChecked() && scene_files.size() == 1) {
         load_stl(filename, true);
     }
 }
 
 void Window::on_autoreload_triggered(bool b)
 {
+    // Scratch memory is only worth keeping for the next reload
+    Workspace::set_retain(b);
     if (b) {
         on_reload();
+    } else {
+        snapshot.clear();
     }
     QSettings().setValue(AUTORELOAD_KEY, b);
 }
 
+void Window::on_single_instance_triggered(bool s)
+{
+    QSettings().setValue(SingleInstance::SINGLE_INSTANCE_KEY, s);
+    emit single_instance_changed(s);
+}
+
 void Window::on_clear_recent()
 {
     QSettings settings;
@@ -428,9 +585,208 @@ void Window::on_load_recent(QAction* a)
     load_stl(a->data().toString());
 }
 
+void Window::on_got_mesh(Mesh* m, bool is_reload)
+{
+    // Meshes from a load that has since been superseded are dropped.  Any
+    // snapshot so far describes the mesh being replaced, so it's dropped
+    // too, until the snapshot of the new mesh arrives.
+    const int part = part_of(sender());
+    if (part >= 0) {
+        snapshot.clear();
+        canvas->load_mesh(m, is_reload, part);
+        canvas->set_part_visible(part, parts_list->item(part)->checkState() == Qt::Checked);
+    } else {
+        delete m;
+    }
+}
+
+void Window::on_got_lod(Mesh* m, int level)
+{
+    Q_UNUSED(level);
+    const int part = part_of(sender());
+    if (part >= 0) {
+        canvas->add_lod(m, part);
+    } else {
+        delete m;
+    }
+}
+
+void Window::on_got_paged_mesh(PagedMesh* m, bool is_reload)
+{
+    const int part = part_of(sender());
+    if (part >= 0) {
+        snapshot.clear();
+        canvas->load_paged_mesh(m, is_reload, part);
+        canvas->set_part_visible(part, parts_list->item(part)->checkState() == Qt::Checked);
+    } else {
+        delete m;
+    }
+}
+
+void Window::on_got_patch(MeshPatch* p)
+{
+    // If the canvas can't patch its mesh after all, load the file afresh
+    const int part = part_of(sender());
+    if (part < 0) {
+        delete p;
+    } else if (!canvas->patch_mesh(p, part)) {
+        snapshot.clear();
+        load_files(scene_files, true);
+    }
+}
+
+void Window::on_got_snapshot(FileSnapshot* s)
+{
+    // Snapshots follow the mesh they describe, which is now the part's
+    const int part = part_of(sender());
+    if (part >= 0) {
+        s->serial = canvas->part_serial(part);
+        snapshot.reset(s);
+    } else {
+        delete s;
+    }
+}
+
 void Window::on_loaded(const QString& filename)
 {
+    const int part = part_of(sender());
+    if (part < 0) {
+        return;
+    }
+    canvas->set_load_profile(loaders[part]->load_profile());
+    if (loaders.size() > 1) {
+        loaded_parts++;
+        canvas->set_status(QStringLiteral("Loaded %1 of %2 parts").arg(loaded_parts).arg(loaders.size()));
+        return;
+    }
+
+    canvas->clear_status();
+    set_current_file(filename);
+}
+
+void Window::set_current_file(const QString& filename)
+{
+    if (filename[0] != ':') {
+        setWindowTitle(filename);
+        set_watched(filename);
+    }
     current_file = filename;
+    prefetch_neighbors();
+}
+
+void Window::prefetch_neighbors()
+{
+    if (prefetch_depth == 0 || current_file.isEmpty() || current_file[0] == ':') {
+        prefetcher->prefetch(QStringList(), quantize_mode());
+        return;
+    }
+
+    // Once the folder has been indexed, this is called again
+    if (!index_folder()) {
+        return;
+    }
+    const int index = folder_files->index_of(QFileInfo(current_file).fileName());
+    if (index < 0) {
+        return;
+    }
+
+    // Look further ahead in the direction the user is stepping through the
+    // folder, keeping just the file behind them.  Stepping the other way
+    // changes the wanted files, which cancels the prefetches that were
+    // running ahead.
+    const int travel = (folder_position >= 0 && std::abs(index - folder_position) == 1) ? index - folder_position : 0;
+    folder_position = index;
+
+    const QString dir = QFileInfo(current_file).absolutePath() + QDir::separator();
+    QStringList wanted;
+    for (int i = 1; i <= prefetch_depth; ++i) {
+        for (int step : {travel ? travel : 1, travel ? -travel : -1}) {
+            const int n = index + step * i;
+            if ((i == 1 || step == travel || !travel) && n >= 0 && n < folder_files->size()) {
+                wanted.append(dir + folder_files->at(n));
+            }
+        }
+    }
+    prefetcher->prefetch(wanted, quantize_mode());
+}
+
+bool Window::show_prefetched(const QString& filename)
+{
+    Mesh* mesh;
+    QVector<Mesh*> lods;
+    LoadProfile profile;
+    if (!prefetcher->fetch(filename, mesh, lods, profile)) {
+        return false;
+    }
+
+    cancel_loads();
+    begin_scene(QStringList(filename), false);
+    canvas->load_mesh(mesh, false);
+    for (auto lod : lods) {
+        canvas->add_lod(lod);
+    }
+    canvas->set_load_profile(profile);
+    canvas->clear_status();
+    set_current_file(filename);
+    return true;
+}
+
+void Window::on_prefetched(const QString& filename)
+{
+    if (filename == awaited_file) {
+        show_prefetched(filename);
+    }
+}
+
+void Window::on_prefetch_failed(const QString& filename)
+{
+    // Load the file normally, which reports whatever went wrong
+    if (filename == awaited_file) {
+        load_files(QStringList(filename));
+    }
+}
+
+void Window::on_loader_finished()
+{
+    if (part_of(sender()) < 0) {
+        return;
+    }
+    running_loaders--;
+    start_loaders();
+    if (running_loaders == 0) {
+        canvas->clear_status();
+    }
+}
+
+void Window::on_part_toggled(QListWidgetItem* item)
+{
+    canvas->set_part_visible(parts_list->row(item), item->checkState() == Qt::Checked);
+}
+
+int Window::part_of(QObject* loader) const
+{
+    for (int i = 0; i < loaders.size(); ++i) {
+        if (loaders[i] && loaders[i].data() == loader) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool Window::show_load_error(QObject* loader)
+{
+    const int part = part_of(loader);
+    if (part < 0) {
+        return false;
+    } else if (loaders.size() == 1) {
+        return true;
+    }
+
+    // A dialog for each bad file would bury the rest of the scene
+    auto item = parts_list->item(part);
+    item->setText(item->text() + " (failed)");
+    item->setFlags(item->flags() & ~Qt::ItemIsEnabled);
+    return false;
 }
 
 void Window::on_save_screenshot()
@@ -494,9 +850,14 @@ void Window::rebuild_recent_files()
 
 void Window::on_reload()
 {
-    auto fs = watcher->files();
-    if (fs.size() == 1) {
-        load_stl(fs[0], true);
+    if (scene_files.size() > 1) {
+        load_files(scene_files, true);
+        return;
+    }
+
+    const auto path = watcher->path();
+    if (!path.isEmpty()) {
+        load_stl(path, true);
     }
 }
 
@@ -522,46 +883,168 @@ void Window::on_common_view_change(QAction* common)
 
 bool Window::load_stl(const QString& filename, bool is_reload)
 {
-    if (!open_action->isEnabled())
+    // A prefetched file only needs uploading, and one that's being decoded
+    // right now is waited for rather than loaded a second time.  A file
+    // that's only queued would decode behind the others (and slowly), so
+    // it's loaded normally instead.
+    if (!is_reload) {
+        if (show_prefetched(filename)) {
+            return true;
+        } else if (prefetcher->decoding(filename)) {
+            cancel_loads();
+            awaited_file = filename;
+            requested_file = filename;
+            canvas->set_status("Loading " + filename);
+            return true;
+        }
+        prefetcher->drop(filename);
+    }
+    return load_files(QStringList(filename), is_reload);
+}
+
+bool Window::load_files(const QStringList& filenames, bool is_reload)
+{
+    if (filenames.isEmpty()) {
         return false;
+    }
+    cancel_loads();
+
+    // Files are loaded a few at a time, and the cores are split between
+    // the loaders that run at once: a scene of many small files keeps
+    // every core busy with a file each, while a single large file gets
+    // all of them for its own parallel stages.
+    const int cores = std::max(QThread::idealThreadCount(), 1);
+    max_loaders = std::min(filenames.size(), cores);
+    const int threads = std::max(cores / max_loaders, 1);
+
+    // A single file that's watched for changes is loaded incrementally, so
+    // that its reloads can build on the load before
+    const bool incremental = autoreload_action->isChecked() && filenames.size() == 1 && filenames.front()[0] != ':';
+    const bool same_scene = is_reload && filenames == scene_files;
+
+    const QuantizeMode quantize = quantize_mode();
+    for (const auto& filename : filenames) {
+        auto loader = new Loader(this, filename, is_reload, quantize);
+        loader->set_worker_threads(threads);
+        loader->set_incremental(incremental, same_scene ? snapshot : QSharedPointer<const FileSnapshot>());
+        connect(loader, &Loader::got_mesh, this, &Window::on_got_mesh);
+        connect(loader, &Loader::got_lod, this, &Window::on_got_lod);
+        connect(loader, &Loader::got_paged_mesh, this, &Window::on_got_paged_mesh);
+        connect(loader, &Loader::got_patch, this, &Window::on_got_patch);
+        connect(loader, &Loader::got_snapshot, this, &Window::on_got_snapshot);
+        connect(loader, &Loader::error_bad_stl, this, &Window::on_bad_stl);
+        connect(loader, &Loader::error_empty_mesh, this, &Window::on_empty_mesh);
+        connect(loader, &Loader::error_missing_file, this, &Window::on_missing_file);
+        connect(loader, &Loader::error_page_file, this, &Window::on_page_file_error);
+        connect(loader, &Loader::loaded_file, this, &Window::on_loaded);
 
-    canvas->set_status("Loading " + filename);
+        connect(loader, &Loader::finished, loader, &Loader::deleteLater);
+        connect(loader, &Loader::finished, this, &Window::on_loader_finished);
+        loaders.push_back(loader);
+    }
+
+    begin_scene(filenames, is_reload);
+    if (filenames.size() == 1) {
+        canvas->set_status("Loading " + filenames.front());
+    } else {
+        canvas->set_status(QStringLiteral("Loading %1 files").arg(filenames.size()));
+    }
 
-    Loader* loader = new Loader(this, filename, is_reload);
-    connect(loader, &Loader::started, this, &Window::disable_open);
+    start_loaders();
+    return true;
+}
 
-    connect(loader, &Loader::got_mesh, canvas, &Canvas::load_mesh);
-    connect(loader, &Loader::error_bad_stl, this, &Window::on_bad_stl);
-    connect(loader, &Loader::error_empty_mesh, this, &Window::on_empty_mesh);
-    connect(loader, &Loader::error_missing_file, this, &Window::on_missing_file);
+void Window::cancel_loads()
+{
+    // Only the newest load gets to finish: any loads still in flight are
+    // asked to stop, and whatever they still emit is ignored by the slots
+    // above (which only listen to the current scene's loaders).  Queued
+    // loads that never started are simply dropped.
+    for (int i = 0; i < loaders.size(); ++i) {
+        if (i >= next_loader) {
+            delete loaders[i];
+        } else if (loaders[i]) {
+            loaders[i]->requestInterruption();
+        }
+    }
+    loaders.clear();
+    next_loader = 0;
+    running_loaders = 0;
+    loaded_parts = 0;
+    awaited_file.clear();
+    pending_step = 0;
+}
 
-    connect(loader, &Loader::finished, loader, &Loader::deleteLater);
-    connect(loader, &Loader::finished, this, &Window::enable_open);
-    connect(loader, &Loader::finished, canvas, &Canvas::clear_status);
+void Window::begin_scene(const QStringList& filenames, bool is_reload)
+{
+    // Reloading the same scene keeps each part's visibility
+    QVector<bool> visible;
+    for (int i = 0; filenames == scene_files && i < parts_list->count(); ++i) {
+        visible.push_back(parts_list->item(i)->checkState() == Qt::Checked);
+    }
+    parts_list->clear();
+    if (!is_reload || filenames != scene_files) {
+        snapshot.clear();
+    }
+    for (int i = 0; i < filenames.size(); ++i) {
+        auto item = new QListWidgetItem(QFileInfo(filenames[i]).fileName());
+        item->setToolTip(filenames[i]);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState((i < visible.size() && !visible[i]) ? Qt::Unchecked : Qt::Checked);
+        parts_list->addItem(item);
+    }
+    scene_files = filenames;
+    requested_file = filenames.front();
+    canvas->begin_scene(filenames.size(), is_reload);
+
+    // Scenes of several files aren't part of a folder being stepped through
+    if (filenames.size() > 1) {
+        setWindowTitle(QStringLiteral("%1 (%2 parts)").arg(QFileInfo(filenames.front()).absolutePath()).arg(filenames.size()));
+        current_file = filenames.front();
+        prefetcher->prefetch(QStringList(), quantize_mode());
+    }
+    parts_dock->setVisible(filenames.size() > 1);
 
-    if (filename[0] != ':') {
-        connect(loader, &Loader::loaded_file, this, &Window::setWindowTitle);
-        connect(loader, &Loader::loaded_file, this, &Window::set_watched);
-        connect(loader, &Loader::loaded_file, this, &Window::on_loaded);
+    if (filenames.front()[0] != ':') {
         reload_action->setEnabled(true);
     }
+}
 
-    loader->start();
-    return true;
+QuantizeMode Window::quantize_mode() const
+{
+    if (quantize_never_action->isChecked()) {
+        return quantize_never;
+    } else if (quantize_always_action->isChecked()) {
+        return quantize_always;
+    }
+    return quantize_auto;
+}
+
+void Window::start_loaders()
+{
+    while (running_loaders < max_loaders && next_loader < loaders.size()) {
+        loaders[next_loader++]->start();
+        running_loaders++;
+    }
 }
 
 void Window::dragEnterEvent(QDragEnterEvent* event)
 {
     if (event->mimeData()->hasUrls()) {
-        auto urls = event->mimeData()->urls();
-        if (urls.size() == 1 && urls.front().path().endsWith(".stl"))
+        const auto urls = event->mimeData()->urls();
+        const bool all_stl = std::all_of(urls.begin(), urls.end(), [](const QUrl& url) { return url.path().endsWith(".stl"); });
+        if (!urls.isEmpty() && all_stl)
             event->acceptProposedAction();
     }
 }
 
 void Window::dropEvent(QDropEvent* event)
 {
-    load_stl(event->mimeData()->urls().front().toLocalFile());
+    QStringList filenames;
+    for (const auto& url : event->mimeData()->urls()) {
+        filenames.append(url.toLocalFile());
+    }
+    load_files(filenames);
 }
 
 void Window::resizeEvent(QResizeEvent* event)
@@ -576,93 +1059,54 @@ void Window::moveEvent(QMoveEvent* event)
     QWidget::moveEvent(event);
 }
 
-void Window::sorted_insert(QStringList& list, const QCollator& collator, const QString& value)
+bool Window::index_folder()
 {
-    int start = 0;
-    int end = list.size() - 1;
-    int index = 0;
-    while (start <= end) {
-        int mid = (start + end) / 2;
-        if (list[mid] == value) {
-            return;
-        }
-        int compare = collator.compare(value, list[mid]);
-        if (compare < 0) {
-            end = mid - 1;
-            index = mid;
-        } else {
-            start = mid + 1;
-            index = start;
-        }
+    const QString folder = QFileInfo(requested_file).absolutePath();
+    if (folder != folder_files->folder()) {
+        folder_files->set_folder(folder);
+        folder_position = -1;
     }
-
-    list.insert(index, value);
+    return folder_files->ready();
 }
 
-void Window::build_folder_file_list()
+void Window::on_folder_indexed()
 {
-    QString current_folder_path = QFileInfo(current_file).absoluteDir().absolutePath();
-    if (!lookup_folder_files.isEmpty()) {
-        if (current_folder_path == lookup_folder) {
-            return;
-        }
-
-        lookup_folder_files.clear();
-    }
-    lookup_folder = current_folder_path;
-
-    QCollator collator;
-    collator.setNumericMode(true);
-
-    QDirIterator dirIterator(lookup_folder, QStringList() << "*.stl", QDir::Files | QDir::Readable | QDir::Hidden);
-    while (dirIterator.hasNext()) {
-        dirIterator.next();
-
-        QString name = dirIterator.fileName();
-        sorted_insert(lookup_folder_files, collator, name);
+    // Steps taken while the folder was being indexed are carried out now
+    const int step = pending_step;
+    pending_step = 0;
+    if (step < 0) {
+        load_prev();
+    } else if (step > 0) {
+        load_next();
+    } else if (scene_files.size() == 1) {
+        prefetch_neighbors();
     }
 }
 
 QPair<QString, QString> Window::get_file_neighbors()
 {
-    if (current_file.isEmpty()) {
+    if (requested_file.isEmpty() || !index_folder()) {
         return QPair<QString, QString>(QString(), QString());
     }
 
-    build_folder_file_list();
-
-    QFileInfo fileInfo(current_file);
-
-    QString current_dir = fileInfo.absoluteDir().absolutePath();
-    QString current_name = fileInfo.fileName();
-
-    QString prev = QString();
-    QString next = QString();
-
-    QListIterator<QString> fileIterator(lookup_folder_files);
-    while (fileIterator.hasNext()) {
-        QString name = fileIterator.next();
-
-        if (name == current_name) {
-            if (fileIterator.hasNext()) {
-                next = current_dir + QDir::separator() + fileIterator.next();
-            }
-            break;
-        }
-
-        prev = name;
-    }
-
-    if (!prev.isEmpty()) {
-        prev.prepend(QDir::separator());
-        prev.prepend(current_dir);
+    const int index = folder_files->index_of(QFileInfo(requested_file).fileName());
+    if (index < 0) {
+        return QPair<QString, QString>(QString(), QString());
     }
 
+    const QString dir = QFileInfo(requested_file).absolutePath() + QDir::separator();
+    QString prev = index > 0 ? dir + folder_files->at(index - 1) : QString();
+    QString next = index + 1 < folder_files->size() ? dir + folder_files->at(index + 1) : QString();
     return QPair<QString, QString>(prev, next);
 }
 
 bool Window::load_prev(void)
 {
+    if (!requested_file.isEmpty() && !index_folder()) {
+        pending_step = -1;
+        return true;
+    }
+
     QPair<QString, QString> neighbors = get_file_neighbors();
     if (neighbors.first.isEmpty()) {
         return false;
@@ -673,6 +1117,11 @@ bool Window::load_prev(void)
 
 bool Window::load_next(void)
 {
+    if (!requested_file.isEmpty() && !index_folder()) {
+        pending_step = 1;
+        return true;
+    }
+
     QPair<QString, QString> neighbors = get_file_neighbors();
     if (neighbors.second.isEmpty()) {
         return false;
@@ -683,11 +1132,6 @@ bool Window::load_next(void)
 
 void Window::keyPressEvent(QKeyEvent* event)
 {
-    if (!open_action->isEnabled()) {
-        QMainWindow::keyPressEvent(event);
-        return;
-    }
-
     if (event->key() == Qt::Key_Left) {
         load_prev();
         return;
@@ -2,12 +2,22 @@
 #define WINDOW_H
 
 #include <QActionGroup>
-#include <QCollator>
-#include <QFileSystemWatcher>
 #include <QMainWindow>
+#include <QPointer>
+
+#include "loader.h"
 
 class Canvas;
+class FileWatcher;
+class FolderIndex;
+class Mesh;
+struct MeshPatch;
+class PagedMesh;
+class Prefetcher;
 class ShaderLightPrefs;
+class QDockWidget;
+class QListWidget;
+class QListWidgetItem;
 
 class Window : public QMainWindow
 {
@@ -15,6 +25,9 @@ class Window : public QMainWindow
 public:
     explicit Window(QWidget* parent = 0);
     bool load_stl(const QString& filename, bool is_reload = false);
+    /*  Loads a scene with one part per file, loading several files at a
+     *  time and showing each part as soon as it is ready */
+    bool load_files(const QStringList& filenames, bool is_reload = false);
     bool load_prev(void);
     bool load_next(void);
 
@@ -25,6 +38,10 @@ protected:
     void moveEvent(QMoveEvent* event) override;
     void keyPressEvent(QKeyEvent* event) override;
 
+signals:
+    /*  Emitted when single-instance mode is switched on or off */
+    void single_instance_changed(bool enabled);
+
 public slots:
     void on_open();
     void on_open_external() const;
@@ -32,9 +49,7 @@ public slots:
     void on_bad_stl();
     void on_empty_mesh();
     void on_missing_file();
-
-    void enable_open();
-    void disable_open();
+    void on_page_file_error();
 
     void set_watched(const QString& filename);
 
@@ -43,14 +58,29 @@ private slots:
     void on_drawMode(QAction* mode);
     void on_drawAxes(bool d);
     void on_invertZoom(bool d);
+    void on_adaptiveResolution(bool d);
+    void on_supersample(bool d);
     void on_resetTransformOnLoad(bool d);
+    void on_quantize(QAction* mode);
+    void on_prefetchDepth(QAction* depth);
     void on_watched_change(const QString& filename);
     void on_reload();
     void on_common_view_change(QAction* common);
     void on_autoreload_triggered(bool r);
+    void on_single_instance_triggered(bool s);
     void on_clear_recent();
     void on_load_recent(QAction* a);
+    void on_got_mesh(Mesh* m, bool is_reload);
+    void on_got_lod(Mesh* m, int level);
+    void on_got_paged_mesh(PagedMesh* m, bool is_reload);
+    void on_got_patch(MeshPatch* p);
+    void on_got_snapshot(FileSnapshot* s);
     void on_loaded(const QString& filename);
+    void on_loader_finished();
+    void on_part_toggled(QListWidgetItem* item);
+    void on_prefetched(const QString& filename);
+    void on_prefetch_failed(const QString& filename);
+    void on_folder_indexed();
     void on_save_screenshot();
     void on_fullscreen();
     void on_hide_menuBar();
@@ -59,10 +89,33 @@ private slots:
 private:
     void rebuild_recent_files();
     void load_persist_settings();
-    void sorted_insert(QStringList& list, const QCollator& collator, const QString& value);
-    void build_folder_file_list();
+    /*  Starts indexing the current file's folder if it isn't already,
+     *  returning true once the index is ready */
+    bool index_folder();
     QPair<QString, QString> get_file_neighbors();
 
+    /*  Returns the scene part that a loader is loading, or -1 if the
+     *  loader has been superseded */
+    int part_of(QObject* loader) const;
+    /*  Starts queued loaders until the pool is full */
+    void start_loaders();
+    /*  Stops every load in flight, ignoring anything they still emit */
+    void cancel_loads();
+    /*  Sets up the parts list and canvas for a scene of the given files */
+    void begin_scene(const QStringList& filenames, bool is_reload);
+    QuantizeMode quantize_mode() const;
+
+    /*  Records a single-file scene as the one being looked at, and starts
+     *  prefetching its neighbors in the folder */
+    void set_current_file(const QString& filename);
+    void prefetch_neighbors();
+    /*  Shows a file straight from the prefetch cache, returning false if
+     *  it isn't there */
+    bool show_prefetched(const QString& filename);
+    /*  Returns true if a loader's error should be shown in a dialog; in a
+     *  scene of many parts, the failed part is marked in the list instead */
+    bool show_load_error(QObject* loader);
+
     QAction* const open_action;
     QAction* const open_external_action;
     QAction* const about_action;
@@ -84,32 +137,76 @@ private:
     QAction* const drawModePrefs_action;
     QAction* const axes_action;
     QAction* const invert_zoom_action;
+    QAction* const adaptive_resolution_action;
+    QAction* const supersample_action;
     QAction* const reload_action;
     QAction* const autoreload_action;
+    QAction* const single_instance_action;
     QAction* const save_screenshot_action;
     QAction* const hide_menuBar_action;
     QAction* const fullscreen_action;
     QAction* const resetTransformOnLoadAction;
+    QAction* const quantize_never_action;
+    QAction* const quantize_always_action;
+    QAction* const quantize_auto_action;
 
     QMenu* const recent_files;
     QActionGroup* const recent_files_group;
     QAction* const recent_files_clear_action;
+    QActionGroup* prefetch_depths;
     const static int MAX_RECENT_FILES = 8;
     static const QString OPEN_EXTERNAL_KEY;
     const static QString RECENT_FILE_KEY;
     const static QString INVERT_ZOOM_KEY;
+    const static QString ADAPTIVE_RESOLUTION_KEY;
+    const static QString SUPERSAMPLE_KEY;
     const static QString AUTORELOAD_KEY;
     const static QString DRAW_AXES_KEY;
     const static QString PROJECTION_KEY;
     const static QString DRAW_MODE_KEY;
     const static QString WINDOW_GEOM_KEY;
     const static QString RESET_TRANSFORM_ON_LOAD_KEY;
+    const static QString QUANTIZE_KEY;
+    const static QString PREFETCH_DEPTH_KEY;
+    const static QString PREFETCH_BUDGET_KEY;
 
     QString current_file;
-    QString lookup_folder;
-    QStringList lookup_folder_files;
-
-    QFileSystemWatcher* watcher;
+    /*  The file that was asked for last, which may still be loading.
+     *  Steps through the folder start from here, so that holding down an
+     *  arrow key moves on rather than restarting the same file. */
+    QString requested_file;
+
+    /*  The current file's folder.  folder_position is the current file's
+     *  position in it, and pending_step is a step through the folder that
+     *  was taken before it had been indexed. */
+    FolderIndex* folder_files;
+    int folder_position;
+    int pending_step;
+
+    FileWatcher* watcher;
+
+    /*  Decodes the files around the current one in its folder, up to
+     *  prefetch_depth files in the direction of travel */
+    Prefetcher* prefetcher;
+    int prefetch_depth;
+    /*  A file that's being prefetched, to be shown once it's ready */
+    QString awaited_file;
+
+    /*  Files of the current scene, with one loader per file (in the same
+     *  order), of which at most max_loaders run at once */
+    QStringList scene_files;
+    QVector<QPointer<Loader>> loaders;
+    int next_loader;
+    int running_loaders;
+    int max_loaders;
+    int loaded_parts;
+
+    /*  What the last incremental load of a single-file scene left behind
+     *  for its next reload */
+    QSharedPointer<const FileSnapshot> snapshot;
+
+    QDockWidget* parts_dock;
+    QListWidget* parts_list;
 
     Canvas* canvas;
 
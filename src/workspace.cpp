@@ -0,0 +1,265 @@
+#include <QMutex>
+#include <QSettings>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "workspace.h"
+
+#ifdef Q_OS_UNIX
+#    include <sys/mman.h>
+#endif
+
+const QString Workspace::BUDGET_KEY = "workspaceBudgetMB";
+const QString Workspace::HUGE_PAGES_KEY = "workspaceHugePages";
+
+namespace
+{
+/*  Nothing smaller than this is pooled */
+const size_t MIN_BYTES = 1 << 16;
+
+/*  Transparent huge pages are only worth asking for on buffers that
+ *  span a good number of them */
+const size_t HUGE_PAGE_BYTES = 8 << 20;
+
+struct Block {
+    void* ptr;
+    size_t bytes;
+    quint64 released;
+};
+
+struct Pool {
+    Pool() :
+        configured(false), budget(0), huge_pages(false), retain(false), idle_bytes(0), borrowed(0), peak(0),
+        last_peak(0), clock(0)
+    {
+        // Nothing to do here
+    }
+    ~Pool();
+
+    QMutex mutex;
+    bool configured;
+    size_t budget;
+    bool huge_pages;
+    bool retain;
+
+    std::vector<Block> idle;
+    size_t idle_bytes;
+
+    /*  Bytes currently borrowed, and the most that have been borrowed at
+     *  once since none were last out.  Every buffer a load borrows is back
+     *  by the time it's done, so last_peak (the previous stretch's peak) is
+     *  the size of the last load's whole set of buffers. */
+    size_t borrowed;
+    size_t peak;
+    size_t last_peak;
+
+    quint64 clock;
+};
+
+Pool& pool()
+{
+    static Pool p;
+    return p;
+}
+
+/*  Rounds a size up to the next of 4, 5, 6 or 7 times a power of two, so
+ *  that at most a fifth of any buffer goes to waste */
+size_t size_class(size_t bytes)
+{
+    if (bytes <= MIN_BYTES) {
+        return MIN_BYTES;
+    }
+    size_t top = MIN_BYTES;
+    while (top <= bytes / 2) {
+        top <<= 1;
+    }
+    const size_t step = top / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+void* allocate(size_t bytes, bool huge_pages)
+{
+#ifdef Q_OS_UNIX
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+#    ifdef MADV_HUGEPAGE
+    if (huge_pages && bytes >= HUGE_PAGE_BYTES) {
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#    else
+    Q_UNUSED(huge_pages);
+#    endif
+    return ptr;
+#else
+    Q_UNUSED(huge_pages);
+    return std::calloc(bytes, 1);
+#endif
+}
+
+void deallocate(void* ptr, size_t bytes)
+{
+#ifdef Q_OS_UNIX
+    munmap(ptr, bytes);
+#else
+    Q_UNUSED(bytes);
+    std::free(ptr);
+#endif
+}
+
+Pool::~Pool()
+{
+    for (const auto& b : idle) {
+        deallocate(b.ptr, b.bytes);
+    }
+}
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+Workspace::Buffer::Buffer() : ptr(nullptr), bytes(0), is_fresh(false)
+{
+    // Nothing to do here
+}
+
+Workspace::Buffer::Buffer(void* ptr, size_t bytes, bool fresh) : ptr(ptr), bytes(bytes), is_fresh(fresh)
+{
+    // Nothing to do here
+}
+
+Workspace::Buffer::Buffer(Buffer&& other) : ptr(other.ptr), bytes(other.bytes), is_fresh(other.is_fresh)
+{
+    other.ptr = nullptr;
+    other.bytes = 0;
+}
+
+Workspace::Buffer& Workspace::Buffer::operator=(Buffer&& other)
+{
+    if (this != &other) {
+        if (ptr) {
+            Workspace::release(ptr, bytes);
+        }
+        ptr = other.ptr;
+        bytes = other.bytes;
+        is_fresh = other.is_fresh;
+        other.ptr = nullptr;
+        other.bytes = 0;
+    }
+    return *this;
+}
+
+Workspace::Buffer::~Buffer()
+{
+    if (ptr) {
+        Workspace::release(ptr, bytes);
+    }
+}
+
+size_t Workspace::Buffer::size() const
+{
+    return bytes;
+}
+
+bool Workspace::Buffer::fresh() const
+{
+    return is_fresh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+Workspace::Buffer Workspace::acquire(size_t bytes)
+{
+    const size_t size = size_class(bytes);
+    Pool& p = pool();
+    bool huge_pages;
+    {
+        QMutexLocker lock(&p.mutex);
+        if (!p.configured) {
+            QSettings settings;
+            p.budget = size_t(std::max<qint64>(settings.value(BUDGET_KEY, 256).toLongLong(), 0)) << 20;
+            p.huge_pages = settings.value(HUGE_PAGES_KEY, true).toBool();
+            p.configured = true;
+        }
+        huge_pages = p.huge_pages;
+        p.borrowed += size;
+        p.peak = std::max(p.peak, p.borrowed);
+
+        // Take the most recently used buffer of the right size, which is
+        // the one most likely to still be resident
+        auto best = p.idle.end();
+        for (auto b = p.idle.begin(); b != p.idle.end(); ++b) {
+            if (b->bytes == size && (best == p.idle.end() || b->released > best->released)) {
+                best = b;
+            }
+        }
+        if (best != p.idle.end()) {
+            void* const ptr = best->ptr;
+            p.idle_bytes -= size;
+            p.idle.erase(best);
+            return Buffer(ptr, size, false);
+        }
+    }
+
+    void* const ptr = allocate(size, huge_pages);
+    if (!ptr) {
+        QMutexLocker lock(&p.mutex);
+        p.borrowed -= size;
+        throw std::bad_alloc();
+    }
+    return Buffer(ptr, size, true);
+}
+
+void Workspace::release(void* ptr, size_t bytes)
+{
+    Pool& p = pool();
+    std::vector<Block> dropped;
+    {
+        QMutexLocker lock(&p.mutex);
+        p.borrowed -= bytes;
+        if (p.borrowed == 0) {
+            p.last_peak = p.peak;
+            p.peak = 0;
+        }
+        if (!p.retain) {
+            lock.unlock();
+            deallocate(ptr, bytes);
+            return;
+        }
+        p.idle.push_back({ptr, bytes, ++p.clock});
+        p.idle_bytes += bytes;
+        const size_t budget = std::max(p.budget, std::max(p.peak, p.last_peak));
+        while (p.idle_bytes > budget) {
+            const auto oldest = std::min_element(p.idle.begin(), p.idle.end(),
+                                                 [](const Block& a, const Block& b) { return a.released < b.released; });
+            p.idle_bytes -= oldest->bytes;
+            dropped.push_back(*oldest);
+            p.idle.erase(oldest);
+        }
+    }
+
+    // Unmapping big buffers takes a while, so it's done outside the lock
+    for (const auto& b : dropped) {
+        deallocate(b.ptr, b.bytes);
+    }
+}
+
+void Workspace::set_retain(bool retain)
+{
+    Pool& p = pool();
+    std::vector<Block> dropped;
+    {
+        QMutexLocker lock(&p.mutex);
+        p.retain = retain;
+        if (!retain) {
+            dropped.swap(p.idle);
+            p.idle_bytes = 0;
+        }
+    }
+    for (const auto& b : dropped) {
+        deallocate(b.ptr, b.bytes);
+    }
+}
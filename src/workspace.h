@@ -0,0 +1,76 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <QString>
+
+#include <cstddef>
+
+/*
+ *  Scratch memory for loading meshes, which is kept between loads.
+ *
+ *  Welding and chunking a big mesh needs several large temporary arrays,
+ *  and autoreloading a file that's saved every few seconds would otherwise
+ *  map, fault in and unmap all of them every time.  Instead, while files
+ *  are being reloaded, buffers go back to a process-wide pool once they're
+ *  done with, sorted into size classes a quarter of a power of two apart,
+ *  and the next load of about the same size picks them up again.  Idle
+ *  buffers are kept within a budget, freeing the least recently used
+ *  first, but the budget always stretches to hold every buffer that the
+ *  last load borrowed at once (so a big mesh's weld table isn't dropped
+ *  just for being big).  On Linux, big buffers may also be backed by transparent huge
+ *  pages.
+ */
+class Workspace
+{
+public:
+    /*  A block of scratch memory, which goes back to the pool when it's
+     *  destroyed.  Its contents are left over from its last use, unless
+     *  it's fresh. */
+    class Buffer
+    {
+    public:
+        Buffer();
+        Buffer(Buffer&& other);
+        Buffer& operator=(Buffer&& other);
+        ~Buffer();
+
+        template <class T>
+        T* as() const
+        {
+            return static_cast<T*>(ptr);
+        }
+        size_t size() const;
+
+        /*  Whether the memory was newly allocated, and so is still zero */
+        bool fresh() const;
+
+    private:
+        friend class Workspace;
+        Buffer(void* ptr, size_t bytes, bool fresh);
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        void* ptr;
+        size_t bytes;
+        bool is_fresh;
+    };
+
+    /*  Borrows a buffer of at least the given size, throwing std::bad_alloc
+     *  if there isn't one to be had */
+    static Buffer acquire(size_t bytes);
+
+    /*  Sets whether released buffers are kept for the next load, which is
+     *  only worth it when the same file is loaded over and over (as with
+     *  autoreload).  Otherwise, buffers are freed as soon as they're done
+     *  with, and turning this off frees any that were idle.  It's off by
+     *  default. */
+    static void set_retain(bool retain);
+
+    const static QString BUDGET_KEY;
+    const static QString HUGE_PAGES_KEY;
+
+private:
+    static void release(void* ptr, size_t bytes);
+};
+
+#endif // WORKSPACE_H
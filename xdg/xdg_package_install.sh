@@ -20,6 +20,10 @@ echo "Drop desktop file in /usr/share/applications/"
 mkdir -p $base/usr/share/applications/
 cp fstlapp-$name.desktop $base/usr/share/applications/
 
+echo "Drop thumbnailer file in /usr/share/thumbnailers/"
+mkdir -p $base/usr/share/thumbnailers/
+cp $name.thumbnailer $base/usr/share/thumbnailers/
+
 slist="16 22 32 48 64 128 256"
 echo "Installing apps icons"
 iclist="fstlapp-$name"